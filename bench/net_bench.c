@@ -0,0 +1,564 @@
+// loopback benchmark of networking transports
+// client keeps window messages in flight, server echoes them back
+// usage: net_bench [messages] [size] [window]
+#define _GNU_SOURCE
+#include "cubebox/net.h"
+#include "cubebox/reliable.h"
+#include "cubebox/server.h"
+#include "cubebox/tinycthread.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+
+#define BENCH_PORT 27700
+#define BENCH_MAX_SIZE 1024
+#define BENCH_LOSS_TIMEOUT 100 // ms without datagrams, in flight ones are lost
+#define BENCH_TCP_BUFFER 65536 // socket buffers of blocking tcp, window must fit
+
+/// SYSCALLS
+
+// socket syscalls made by engine and benchmark, linked with --wrap
+static atomic_long syscalls;
+
+#define WRAP(ret, name, params, args) \
+    ret __real_##name params; \
+    ret __wrap_##name params { \
+        atomic_fetch_add_explicit(&syscalls, 1, memory_order_relaxed); \
+        return __real_##name args; \
+    }
+
+WRAP(ssize_t, recv, (int s, void* buf, size_t len, int flags), (s, buf, len, flags))
+WRAP(ssize_t, send, (int s, const void* buf, size_t len, int flags), (s, buf, len, flags))
+WRAP(ssize_t, recvfrom, (int s, void* buf, size_t len, int flags, struct sockaddr* from, socklen_t* fromlen), (s, buf, len, flags, from, fromlen))
+WRAP(ssize_t, sendto, (int s, const void* buf, size_t len, int flags, const struct sockaddr* to, socklen_t tolen), (s, buf, len, flags, to, tolen))
+WRAP(int, recvmmsg, (int s, struct mmsghdr* messages, unsigned int count, int flags, struct timespec* timeout), (s, messages, count, flags, timeout))
+WRAP(int, sendmmsg, (int s, struct mmsghdr* messages, unsigned int count, int flags), (s, messages, count, flags))
+WRAP(ssize_t, recvmsg, (int s, struct msghdr* message, int flags), (s, message, flags))
+WRAP(ssize_t, sendmsg, (int s, const struct msghdr* message, int flags), (s, message, flags))
+WRAP(ssize_t, readv, (int s, const struct iovec* vectors, int count), (s, vectors, count))
+WRAP(ssize_t, writev, (int s, const struct iovec* vectors, int count), (s, vectors, count))
+WRAP(ssize_t, read, (int s, void* buf, size_t len), (s, buf, len))
+WRAP(ssize_t, write, (int s, const void* buf, size_t len), (s, buf, len))
+WRAP(int, epoll_wait, (int poller, struct epoll_event* events, int max, int timeout), (poller, events, max, timeout))
+WRAP(int, poll, (struct pollfd* fds, nfds_t count, int timeout), (fds, count, timeout))
+WRAP(int, select, (int count, fd_set* read, fd_set* write, fd_set* except, struct timeval* timeout), (count, read, write, except, timeout))
+
+/// BENCH
+
+typedef struct {
+    int messages;
+    int size;
+    int window;
+    int port;
+
+    uint64_t* sendTime; // by sequence, 0 once answered
+    uint64_t* rtt; // answered messages, ns
+    int sent;
+    int received;
+    int lost;
+    int resent; // by transport itself
+
+    atomic_bool ready; // server is listening
+    atomic_bool running; // cleared when client is done
+} bench;
+
+static uint64_t now() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t) time.tv_sec * 1000000000ull + time.tv_nsec;
+}
+
+// fills next message, returns false when all are sent
+static bool nextMessage(bench* b, char* data) {
+    if (b->sent >= b->messages) return false;
+
+    int sequence = b->sent++;
+    memset(data, 0, b->size);
+    memcpy(data, &sequence, sizeof(int));
+    b->sendTime[sequence] = now();
+    return true;
+}
+
+// late and duplicate answers are ignored, returns false for them
+static bool answer(bench* b, const char* data, int length) {
+    int sequence;
+    if (length != b->size) return false;
+    memcpy(&sequence, data, sizeof(int));
+    if (sequence < 0 || sequence >= b->sent || b->sendTime[sequence] == 0) return false;
+
+    b->rtt[b->received++] = now() - b->sendTime[sequence];
+    b->sendTime[sequence] = 0;
+    return true;
+}
+
+static void waitReady(bench* b) {
+    while (!atomic_load(&b->ready)) {
+        thrd_yield();
+    }
+}
+
+// unanswered messages are lost, late answers are ignored
+static void writeOffLost(bench* b) {
+    for (int i = 0; i < b->sent; i++) {
+        if (b->sendTime[i] != 0) {
+            b->sendTime[i] = 0;
+            b->lost++;
+        }
+    }
+}
+
+static bool done(bench* b) {
+    return b->received + b->lost >= b->messages;
+}
+
+static int compareTime(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*) a, y = *(const uint64_t*) b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentile(bench* b, double p) {
+    if (b->received == 0) return 0.0;
+    int index = (int) (p * (b->received - 1) + 0.5);
+    return b->rtt[index] / 1000.0;
+}
+
+static void report(const char* name, bench* b, uint64_t elapsed, long calls) {
+    double seconds = elapsed / 1e9;
+    qsort(b->rtt, b->received, sizeof(uint64_t), compareTime);
+
+    // bytes are echoed payload, one direction
+    printf("%-10s %9.0f msg/s %8.2f MB/s  rtt us p50 %8.1f p99 %8.1f p999 %8.1f  syscalls/msg %5.2f  lost %d resent %d\n",
+        name, b->received / seconds, (double) b->received * b->size / seconds / 1e6,
+        percentile(b, 0.5), percentile(b, 0.99), percentile(b, 0.999),
+        b->received > 0 ? (double) calls / b->received : 0.0, b->lost, b->resent);
+}
+
+/// TCP
+
+static bool readFull(cbSocket s, char* data, int length) {
+    while (length > 0) {
+        int result = cbSocketRead(s, data, length);
+        if (result <= 0) return false;
+        data += result;
+        length -= result;
+    }
+    return true;
+}
+
+static bool writeFull(cbSocket s, char* data, int length) {
+    while (length > 0) {
+        int result = cbSocketWrite(s, data, length);
+        if (result <= 0) return false;
+        data += result;
+        length -= result;
+    }
+    return true;
+}
+
+static int tcpServer(void* arg) {
+    bench* b = arg;
+    cbSocket listener = cbOpenSocket();
+    cbSocketSetBuffers(listener, BENCH_TCP_BUFFER, BENCH_TCP_BUFFER); // accepted socket inherits
+    cbSocketListen(listener, b->port);
+    atomic_store(&b->ready, true);
+
+    cbSocket client = cbSocketAccept(listener);
+    cbSocketSetNoDelay(client, true);
+    char data[BENCH_MAX_SIZE];
+    while (readFull(client, data, b->size) && writeFull(client, data, b->size)) {}
+
+    cbCloseSocket(client);
+    cbCloseSocket(listener);
+    return 0;
+}
+
+// one blocking syscall per read and write
+static void benchTcp(bench* b) {
+    thrd_t thread;
+    thrd_create(&thread, tcpServer, b);
+
+    waitReady(b);
+    cbSocket s = cbOpenSocket();
+    cbSocketSetBuffers(s, BENCH_TCP_BUFFER, BENCH_TCP_BUFFER);
+    cbSocketConnect(s, "127.0.0.1", b->port);
+    cbSocketSetNoDelay(s, true);
+
+    // whole window is written before first read, more would block both sides
+    int window = b->window;
+    if (window * b->size > BENCH_TCP_BUFFER) {
+        window = BENCH_TCP_BUFFER / b->size;
+        printf("tcp window is limited to %d\n", window);
+    }
+
+    char data[BENCH_MAX_SIZE];
+    atomic_store(&syscalls, 0);
+    uint64_t start = now();
+    for (int i = 0; i < window && nextMessage(b, data); i++) {
+        writeFull(s, data, b->size);
+    }
+    while (!done(b) && readFull(s, data, b->size)) {
+        answer(b, data, b->size);
+        if (nextMessage(b, data)) {
+            writeFull(s, data, b->size);
+        }
+    }
+    uint64_t elapsed = now() - start;
+    long calls = atomic_load(&syscalls);
+
+    cbCloseSocket(s);
+    thrd_join(thread, NULL);
+    report("tcp", b, elapsed, calls);
+}
+
+/// CONNECTION
+
+static int echoServer(void* arg) {
+    bench* b = arg;
+    cbServer* server = cbStartServer(b->port, 1);
+    atomic_store(&b->ready, true);
+    if (server == NULL) return 0;
+
+    // simulation thread, echoes until client leaves
+    bool connected = false;
+    while (atomic_load(&b->running) || connected) {
+        cbServerEvent event;
+        if (!cbServerPoll(server, &event)) {
+            thrd_yield();
+            continue;
+        }
+        if (event.type == CB_SERVER_CONNECT) {
+            connected = true;
+        } else if (event.type == CB_SERVER_MESSAGE) {
+            cbServerSend(server, event.client, event.packet);
+            cbPacketRelease(event.packet);
+        } else if (event.type == CB_SERVER_DISCONNECT) {
+            connected = false;
+        }
+    }
+
+    cbStopServer(server);
+    return 0;
+}
+
+// framed client against worker server, frames are coalesced per flush
+static void benchConnection(bench* b) {
+    thrd_t thread;
+    thrd_create(&thread, echoServer, b);
+
+    waitReady(b);
+    cbSocket s = cbOpenSocket();
+    cbSocketConnect(s, "127.0.0.1", b->port);
+    cbSocketSetBlock(s, false);
+    cbSocketSetNoDelay(s, true);
+
+    cbConnection* connection = cbCreateConnection(s);
+    cbPoller* poller = cbCreatePoller();
+    cbPollerAdd(poller, s, CB_POLL_READ, NULL);
+
+    char data[BENCH_MAX_SIZE];
+    atomic_store(&syscalls, 0);
+    uint64_t start = now();
+    for (int i = 0; i < b->window && nextMessage(b, data); i++) {
+        cbConnectionSend(connection, data, b->size);
+    }
+    cbConnectionFlush(connection);
+
+    while (!done(b)) {
+        int received;
+        while ((received = cbConnectionReceive(connection)) > 0) {
+            cbFrame frame;
+            while (cbConnectionNextFrame(connection, &frame) == 1) {
+                if (answer(b, frame.data, frame.length) && nextMessage(b, data)) {
+                    cbConnectionSend(connection, data, b->size);
+                }
+            }
+        }
+        if (received < 0) break;
+        cbConnectionFlush(connection);
+
+        cbSocketEvent event;
+        if (!done(b)) {
+            cbPollerWait(poller, &event, 1, 100);
+        }
+    }
+    uint64_t elapsed = now() - start;
+    long calls = atomic_load(&syscalls);
+
+    atomic_store(&b->running, false);
+    cbPollerRemove(poller, s);
+    cbDestroyPoller(poller);
+    cbDestroyConnection(connection);
+    cbCloseSocket(s);
+    thrd_join(thread, NULL);
+    report("connection", b, elapsed, calls);
+}
+
+/// UDP
+
+static int udpServer(void* arg) {
+    bench* b = arg;
+    cbSocket s = cbOpenUdpSocket();
+    cbSocketSetBuffers(s, 1 << 20, 1 << 20);
+    cbSocketBind(s, b->port);
+    cbSocketSetBlock(s, false);
+    atomic_store(&b->ready, true);
+
+    cbPoller* poller = cbCreatePoller();
+    cbPollerAdd(poller, s, CB_POLL_READ, NULL);
+
+    static char buffers[CB_NET_BATCH][BENCH_MAX_SIZE];
+    cbDatagram datagrams[CB_NET_BATCH];
+    while (atomic_load(&b->running)) {
+        for (int i = 0; i < CB_NET_BATCH; i++) {
+            datagrams[i].data = buffers[i];
+            datagrams[i].length = BENCH_MAX_SIZE;
+        }
+        int count = cbSocketReceiveBatch(s, datagrams, CB_NET_BATCH);
+        if (count > 0) {
+            cbSocketSendBatch(s, datagrams, count); // back to where they came from
+        } else {
+            cbSocketEvent event;
+            cbPollerWait(poller, &event, 1, 10);
+        }
+    }
+
+    cbPollerRemove(poller, s);
+    cbDestroyPoller(poller);
+    cbCloseSocket(s);
+    return 0;
+}
+
+// answers of a batch are sent with one syscall
+static void benchUdp(bench* b) {
+    thrd_t thread;
+    thrd_create(&thread, udpServer, b);
+    waitReady(b);
+
+    cbSocket s = cbOpenUdpSocket();
+    cbSocketSetBuffers(s, 1 << 20, 1 << 20);
+    cbSocketBind(s, 0);
+    cbSocketSetBlock(s, false);
+    cbAddress server;
+    cbMakeAddress(&server, "127.0.0.1", b->port);
+
+    cbPoller* poller = cbCreatePoller();
+    cbPollerAdd(poller, s, CB_POLL_READ, NULL);
+
+    static char received[CB_NET_BATCH][BENCH_MAX_SIZE];
+    static char outgoing[CB_NET_BATCH][BENCH_MAX_SIZE];
+    cbDatagram in[CB_NET_BATCH], out[CB_NET_BATCH];
+    int inFlight = 0;
+
+    atomic_store(&syscalls, 0);
+    uint64_t start = now();
+    while (!done(b)) {
+        // top window up
+        int count = 0;
+        while (inFlight < b->window && count < CB_NET_BATCH && nextMessage(b, outgoing[count])) {
+            out[count].address = server;
+            out[count].data = outgoing[count];
+            out[count].length = b->size;
+            count++;
+            inFlight++;
+        }
+        if (count > 0) {
+            cbSocketSendBatch(s, out, count);
+        }
+
+        for (int i = 0; i < CB_NET_BATCH; i++) {
+            in[i].data = received[i];
+            in[i].length = BENCH_MAX_SIZE;
+        }
+        int answered = cbSocketReceiveBatch(s, in, CB_NET_BATCH);
+        for (int i = 0; i < answered; i++) {
+            if (answer(b, in[i].data, in[i].length)) {
+                inFlight--;
+            }
+        }
+
+        cbSocketEvent event;
+        if (answered <= 0 && !done(b) && cbPollerWait(poller, &event, 1, BENCH_LOSS_TIMEOUT) == 0) {
+            writeOffLost(b); // nothing came back, give up on them
+            inFlight = 0;
+        }
+    }
+    uint64_t elapsed = now() - start;
+    long calls = atomic_load(&syscalls);
+
+    atomic_store(&b->running, false);
+    thrd_join(thread, NULL);
+    cbPollerRemove(poller, s);
+    cbDestroyPoller(poller);
+    cbCloseSocket(s);
+    report("udp", b, elapsed, calls);
+}
+
+/// RELIABLE
+
+typedef struct {
+    cbSocket socket;
+    cbAddress peer;
+} reliablePeer;
+
+static void sendReliable(void* user, const char* data, int length) {
+    reliablePeer* peer = user;
+    cbSocketSendTo(peer->socket, &peer->peer, data, length);
+}
+
+static double seconds() {
+    return now() / 1e9;
+}
+
+// feeds all waiting datagrams, peer address is learned from first one
+static void receiveReliable(reliablePeer* peer, cbEndpoint* endpoint) {
+    static _Thread_local char buffers[CB_NET_BATCH][CB_RELIABLE_MTU];
+    cbDatagram datagrams[CB_NET_BATCH];
+    int count;
+    do {
+        for (int i = 0; i < CB_NET_BATCH; i++) {
+            datagrams[i].data = buffers[i];
+            datagrams[i].length = CB_RELIABLE_MTU;
+        }
+        count = cbSocketReceiveBatch(peer->socket, datagrams, CB_NET_BATCH);
+        for (int i = 0; i < count; i++) {
+            peer->peer = datagrams[i].address;
+            cbEndpointReceivePacket(endpoint, datagrams[i].data, datagrams[i].length, seconds());
+        }
+    } while (count == CB_NET_BATCH);
+}
+
+static int reliableServer(void* arg) {
+    bench* b = arg;
+    reliablePeer peer = {cbOpenUdpSocket(), {0, 0}};
+    cbSocketSetBuffers(peer.socket, 1 << 20, 1 << 20);
+    cbSocketBind(peer.socket, b->port);
+    cbSocketSetBlock(peer.socket, false);
+    atomic_store(&b->ready, true);
+
+    cbPoller* poller = cbCreatePoller();
+    cbPollerAdd(poller, peer.socket, CB_POLL_READ, NULL);
+    cbEndpoint* endpoint = cbCreateEndpoint(sendReliable, &peer);
+
+    while (atomic_load(&b->running)) {
+        cbSocketEvent event;
+        cbPollerWait(poller, &event, 1, 1);
+        receiveReliable(&peer, endpoint);
+
+        cbEndpointMessage message;
+        while (cbEndpointReceive(endpoint, &message)) {
+            cbEndpointSend(endpoint, message.channel, message.data, message.length);
+        }
+        if (peer.peer.port != 0) {
+            cbEndpointUpdate(endpoint, seconds());
+        }
+    }
+
+    cbDestroyEndpoint(endpoint);
+    cbPollerRemove(poller, peer.socket);
+    cbDestroyPoller(poller);
+    cbCloseSocket(peer.socket);
+    return 0;
+}
+
+// reliable ordered channel, messages of one update share packets
+static void benchReliable(bench* b) {
+    thrd_t thread;
+    thrd_create(&thread, reliableServer, b);
+    waitReady(b);
+
+    reliablePeer peer = {cbOpenUdpSocket(), {0, 0}};
+    cbSocketSetBuffers(peer.socket, 1 << 20, 1 << 20);
+    cbSocketBind(peer.socket, 0);
+    cbSocketSetBlock(peer.socket, false);
+    cbMakeAddress(&peer.peer, "127.0.0.1", b->port);
+
+    cbPoller* poller = cbCreatePoller();
+    cbPollerAdd(poller, peer.socket, CB_POLL_READ, NULL);
+    cbEndpoint* endpoint = cbCreateEndpoint(sendReliable, &peer);
+
+    char data[BENCH_MAX_SIZE];
+    atomic_store(&syscalls, 0);
+    uint64_t start = now();
+    for (int i = 0; i < b->window && nextMessage(b, data); i++) {
+        cbEndpointSend(endpoint, 0, data, b->size);
+    }
+    cbEndpointUpdate(endpoint, seconds());
+
+    while (!done(b)) {
+        cbSocketEvent event;
+        cbPollerWait(poller, &event, 1, 1);
+        receiveReliable(&peer, endpoint);
+
+        cbEndpointMessage message;
+        while (cbEndpointReceive(endpoint, &message)) {
+            if (answer(b, message.data, message.length) && nextMessage(b, data)) {
+                cbEndpointSend(endpoint, 0, data, b->size);
+            }
+        }
+        cbEndpointUpdate(endpoint, seconds());
+    }
+    uint64_t elapsed = now() - start;
+    long calls = atomic_load(&syscalls);
+
+    cbEndpointStats stats;
+    cbEndpointGetStats(endpoint, &stats);
+    b->resent = stats.messagesResent;
+
+    atomic_store(&b->running, false);
+    thrd_join(thread, NULL);
+    cbDestroyEndpoint(endpoint);
+    cbPollerRemove(poller, peer.socket);
+    cbDestroyPoller(poller);
+    cbCloseSocket(peer.socket);
+    report("reliable", b, elapsed, calls);
+}
+
+/// MAIN
+
+static void run(const char* name, void (*func)(bench*), int port, int messages, int size, int window) {
+    bench b = {0};
+    b.messages = messages;
+    b.size = size;
+    b.window = window;
+    b.port = port;
+    b.sendTime = calloc(messages, sizeof(uint64_t));
+    b.rtt = calloc(messages, sizeof(uint64_t));
+    atomic_init(&b.ready, false);
+    atomic_init(&b.running, true);
+
+    func(&b);
+
+    if (b.received + b.lost < messages) {
+        printf("%-10s stopped after %d messages\n", name, b.received);
+    }
+    free(b.sendTime);
+    free(b.rtt);
+}
+
+int main(int argc, char** argv) {
+    int messages = argc > 1 ? atoi(argv[1]) : 100000;
+    int size = argc > 2 ? atoi(argv[2]) : 64;
+    int window = argc > 3 ? atoi(argv[3]) : 16;
+    if (messages <= 0 || size < (int) sizeof(int) || size > BENCH_MAX_SIZE || window <= 0) {
+        printf("usage: net_bench [messages] [size 4-%d] [window]\n", BENCH_MAX_SIZE);
+        return 1;
+    }
+
+    cbInitNet();
+    printf("%d messages of %d bytes, %d in flight\n", messages, size, window);
+    run("tcp", benchTcp, BENCH_PORT, messages, size, window);
+    run("connection", benchConnection, BENCH_PORT + 1, messages, size, window);
+    run("udp", benchUdp, BENCH_PORT + 2, messages, size, window);
+    run("reliable", benchReliable, BENCH_PORT + 3, messages, size, window);
+    cbDestroyNet();
+    return 0;
+}
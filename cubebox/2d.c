@@ -1,12 +1,33 @@
 #include "2d.h"
 #include "engine.h"
 #include "utils.h"
+#include "profile.h"
+#include "render.h"
 #include "stb_image.h"
 #include "linmath.h"
 #include "stretchy_buffer.h"
 
 #include <stdbool.h>
 
+struct textureUpload {
+    cbTexture *texture;
+    GLuint format;
+    unsigned char *data;
+};
+
+static void uploadTexture(void *arg) {
+    struct textureUpload *upload = arg;
+    cbTexture *texture = upload->texture;
+
+    // create texture with default params
+    glGenTextures(1, &texture->id);
+    glBindTexture(GL_TEXTURE_2D, texture->id);
+    glTexImage2D(GL_TEXTURE_2D, 0, upload->format, texture->width, texture->height, 0, upload->format, GL_UNSIGNED_BYTE, upload->data);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glGenerateMipmap(GL_TEXTURE_2D);
+}
+
 cbTexture cbLoadTexture(const char *path) {
     cbTexture texture;
     unsigned char *data = stbi_load(path, &texture.width, &texture.height, &texture.channels, 0);
@@ -27,20 +48,24 @@ cbTexture cbLoadTexture(const char *path) {
         break;
     }
 
-    // create texture with default params
-    glGenTextures(1, &texture.id);
-    glBindTexture(GL_TEXTURE_2D, texture.id);
-    glTexImage2D(GL_TEXTURE_2D, 0, format, texture.width, texture.height, 0, format, GL_UNSIGNED_BYTE, data);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glGenerateMipmap(GL_TEXTURE_2D);
+    // decoded here, uploaded on thread owning gl context
+    struct textureUpload upload;
+    upload.texture = &texture;
+    upload.format = format;
+    upload.data = data;
+    cbRenderCall(uploadTexture, &upload);
 
     free(data);
     return texture;
 }
 
+static void deleteTexture(void *arg) {
+    glDeleteTextures(1, (GLuint*) arg);
+}
+
 void cbDestroyTexture(cbTexture texture) {
-    glDeleteTextures(1, &texture.id);
+    // after commands already recorded with it
+    cbRenderSubmit(deleteTexture, &texture.id, sizeof(GLuint));
 }
 
 cbImage cbCreateImage(cbTexture texture) {
@@ -175,43 +200,70 @@ static const char *fragmentShader = "#version 330 core            \n"
             "color = texture(image, texcoords);                   \n"
             "}                                                    \n";
 
-void cbInit2DRenderer() {
+static void initRenderer(void *arg) {
     shaderProgram = cbCreateShader(vertexShader, fragmentShader);
     glGenVertexArrays(1, &vao);
     glGenBuffers(1, &vbo);
 }
 
-static void flushRenderer(GLuint texture) {
-    if (sb_count(vertices) == 0)
-        return;
+void cbInit2DRenderer() {
+    cbRenderCall(initRenderer, NULL);
+}
+
+// recorded batch, vertices are owned by command
+struct drawCommand {
+    GLuint texture;
+    float *vertices; // stretchy buffer
+};
+
+static void drawVertices(void *arg) {
+    struct drawCommand *draw = arg;
+    cbProfileGpuBegin("2d");
 
     // bind vertices
     glBindVertexArray(vao);
     glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, sb_count(vertices) * sizeof(GLfloat), vertices, GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, sb_count(draw->vertices) * sizeof(GLfloat), draw->vertices, GL_STATIC_DRAW);
 
     // bind texture
     glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, texture);
+    glBindTexture(GL_TEXTURE_2D, draw->texture);
 
     // draw sprite
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), 0);
-    glDrawArrays(GL_TRIANGLES, 0, sb_count(vertices) / 4);
+    glDrawArrays(GL_TRIANGLES, 0, sb_count(draw->vertices) / 4);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindVertexArray(0);
+    cbProfileGpuEnd();
 
     // clear vertices
-    sb_free(vertices);
-    vertices = NULL;
+    sb_free(draw->vertices);
 }
 
-void cbStart2DRenderer() {
-    // get ortho from window size
-    int viewX, viewY;
-    cbGetSize(&viewX, &viewY);
-    mat4x4_ortho(projection, 0.0f, (float) viewX, (float) viewY, 0.0f, -1.0f, 1.0f);
+static void flushRenderer(GLuint texture) {
+    if (sb_count(vertices) == 0)
+        return;
 
+    cbProfileBegin("2d flush");
+
+    // count batch
+    cbRenderStats *stats = cbRenderStatsCurrent();
+    stats->drawCalls++;
+    stats->vertices += sb_count(vertices) / 4;
+    stats->bytesUploaded += sb_count(vertices) * sizeof(GLfloat);
+    stats->textureBinds++;
+
+    // vertices go to command
+    struct drawCommand draw;
+    draw.texture = texture;
+    draw.vertices = vertices;
+    cbRenderSubmit(drawVertices, &draw, sizeof(draw));
+    vertices = NULL;
+    cbProfileEnd();
+}
+
+static void startRenderer(void *arg) {
     // setup gl
     glDisable(GL_DEPTH_TEST);
     glEnable(GL_BLEND);
@@ -222,9 +274,21 @@ void cbStart2DRenderer() {
     glUniform1i(glGetUniformLocation(shaderProgram, "image"), 0);
 }
 
+void cbStart2DRenderer() {
+    // get ortho from window size
+    int viewX, viewY;
+    cbGetSize(&viewX, &viewY);
+    mat4x4_ortho(projection, 0.0f, (float) viewX, (float) viewY, 0.0f, -1.0f, 1.0f);
+
+    cbRenderSubmit(startRenderer, NULL, 0);
+}
+
 void cbRenderImage(cbImage image) {
     // batching
     if (currentTexture != image.texture.id) {
+        if (sb_count(vertices) > 0) {
+            cbRenderStatsCurrent()->textureFlushes++;
+        }
         flushRenderer(currentTexture);
     }
     currentTexture = image.texture.id;
@@ -274,13 +338,21 @@ void cbRenderSprite(cbSprite* sprite) {
     cbRenderImage(image);
 }
 
+static void stopRenderer(void *arg) {
+    glUseProgram(0);
+}
+
 void cbStop2DRenderer() {
     flushRenderer(currentTexture);
-    glUseProgram(0);
+    cbRenderSubmit(stopRenderer, NULL, 0);
 }
 
-void cbDestroy2DRenderer() {
+static void destroyRenderer(void *arg) {
     glDeleteVertexArrays(1, &vao);
     glDeleteBuffers(1, &vbo);
     cbDeleteShader(shaderProgram);
 }
+
+void cbDestroy2DRenderer() {
+    cbRenderSubmit(destroyRenderer, NULL, 0);
+}
@@ -4,7 +4,13 @@
 #include "tiled.h"
 #include "font.h"
 #include "net.h"
+#include "reliable.h"
+#include "serialize.h"
 #include "utils.h"
+#include "profile.h"
+#include "render.h"
+#include "job.h"
+#include "server.h"
 
 // thirdparty files
 #include "glad.h"
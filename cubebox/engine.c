@@ -1,12 +1,23 @@
 #include "engine.h"
+#include "profile.h"
+#include "render.h"
+#include "utils.h"
+#include "tinycthread.h"
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
+#include <math.h>
 #include <time.h>
+#include <errno.h>
+#include <stdatomic.h>
 
 #include "glad.h"
 #include <GL/glx.h>
 #include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
 
 // configure single-file libs
 #define STB_IMAGE_IMPLEMENTATION
@@ -26,17 +37,59 @@ static int width = 640, height = 480;
 static bool preventMouseLoop;
 static bool running;
 
+// headless offscreen rendering
+static bool headless = false;
+static EGLDisplay eglDisplay;
+static EGLContext eglContext;
+static EGLSurface eglSurface = EGL_NO_SURFACE;
+static GLuint framebuffer, colorbuffer, depthbuffer;
+
 // engine params
 static char title[255];
 static bool keyStates[CB_KEY_TOTAL];
 static bool mouseStates[CB_MOUSE_TOTAL];
+static int mouseX = 0, mouseY = 0; // from motion events
+
+// input events ring, oldest are dropped on overflow
+static cbEvent eventQueue[CB_EVENT_QUEUE_SIZE];
+static int eventHead = 0, eventCount = 0;
+
+// x events pumped on separate thread
+struct inputRecord {
+    XEvent event;
+    bool repeat; // key press from auto repeat
+};
+static bool inputThreaded = false;
+static cbQueue *inputQueue = NULL; // NULL - pumped by cbRun
+static thrd_t inputThread;
+static atomic_bool inputRunning = false;
+static Atom wakeInputEvent;
+
+// gl commands executed on separate thread
+static bool renderThreaded = false;
+
 static void (*onStartFunc)(void) = NULL;
 static void (*onUpdateFunc)(float) = NULL;
+static void (*onRenderFunc)(float) = NULL;
 static void (*onStopFunc)(void) = NULL;
 
+// fixed timestep
+static double fixedStep = 0.0; // 0 - variable step
+static int maxUpdateSteps = 5;
+
+// frame pacing
+#define CB_FRAME_SPIN_NS 1000000 // sleep until 1 ms before deadline, then spin
+static long long framePeriod = 0; // nanoseconds, 0 - unlimited
+static long long frameDeadline = 0;
+static cbFrameStats frameStats;
+static double frameTimeM2 = 0.0; // welford sum of squares
+static double limiterErrorSum = 0.0;
+static int limiterSamples = 0;
+
 // some extensions used
 typedef GLXContext (*glXCreateContextAttribsARBProc)(Display*, GLXFBConfig, GLXContext, Bool, const int*);
 typedef void (*glXSwapIntervalEXTProc)(Display* dpy, GLXDrawable drawable, int interval);
+typedef int (*glXSwapIntervalMESAProc)(unsigned int interval);
 
 // x error check
 static bool xError = false;
@@ -272,7 +325,202 @@ static cbKey convertKey(KeySym code)
     return CB_KEY_UNKNOWN;
 }
 
+// printable latin-1 and unicode keysyms
+static unsigned int convertText(KeySym sym) {
+    if ((sym >= 0x20 && sym <= 0x7e) || (sym >= 0xa0 && sym <= 0xff)) {
+        return (unsigned int) sym;
+    }
+    if ((sym & 0xff000000) == 0x01000000) {
+        return (unsigned int) (sym & 0x00ffffff);
+    }
+    return 0;
+}
+
+static void initEvent(cbEvent *event, cbEventType type, unsigned long time) {
+    memset(event, 0, sizeof(cbEvent));
+    event->type = type;
+    event->time = time;
+    event->key = CB_KEY_UNKNOWN;
+    event->button = CB_MOUSE_UNKNOWN;
+}
+
+// removes queued event at position from head, later events keep order
+static void removeEvent(int at) {
+    for (int i = at; i < eventCount - 1; i++) {
+        eventQueue[(eventHead + i) % CB_EVENT_QUEUE_SIZE] = eventQueue[(eventHead + i + 1) % CB_EVENT_QUEUE_SIZE];
+    }
+    eventCount--;
+}
+
+static void pushEvent(const cbEvent *event) {
+    // only newest position of consecutive moves matters
+    if (event->type == CB_EVENT_MOUSE_MOVE && eventCount > 0) {
+        cbEvent *last = &eventQueue[(eventHead + eventCount - 1) % CB_EVENT_QUEUE_SIZE];
+        if (last->type == CB_EVENT_MOUSE_MOVE) {
+            *last = *event;
+            return;
+        }
+    }
+
+    // full queue loses moves first, keys and buttons are kept
+    if (eventCount == CB_EVENT_QUEUE_SIZE) {
+        int move = -1;
+        for (int i = 0; i < eventCount && move < 0; i++) {
+            if (eventQueue[(eventHead + i) % CB_EVENT_QUEUE_SIZE].type == CB_EVENT_MOUSE_MOVE) {
+                move = i;
+            }
+        }
+        if (move >= 0) {
+            removeEvent(move);
+        } else if (event->type == CB_EVENT_MOUSE_MOVE) {
+            return;
+        } else {
+            eventHead = (eventHead + 1) % CB_EVENT_QUEUE_SIZE; // oldest
+            eventCount--;
+        }
+    }
+    eventQueue[(eventHead + eventCount) % CB_EVENT_QUEUE_SIZE] = *event;
+    eventCount++;
+}
+
+static void pushKeyEvent(XKeyEvent *xkey, cbEventType type, bool repeat) {
+    cbEvent event;
+    initEvent(&event, type, xkey->time);
+    event.key = convertKey(xkey->keycode);
+    event.repeat = repeat;
+    event.x = xkey->x;
+    event.y = xkey->y;
+    pushEvent(&event);
+
+    if (type != CB_EVENT_KEY_DOWN) return;
+
+    // text input for key down
+    KeySym sym;
+    char buffer[16];
+    XLookupString(xkey, buffer, sizeof(buffer), &sym, NULL);
+    event.codepoint = convertText(sym);
+    if (event.codepoint != 0) {
+        event.type = CB_EVENT_TEXT;
+        pushEvent(&event);
+    }
+}
+
+static void pushButtonEvent(XButtonEvent *xbutton, bool down) {
+    cbEvent event;
+    initEvent(&event, down ? CB_EVENT_MOUSE_DOWN : CB_EVENT_MOUSE_UP, xbutton->time);
+    event.x = mouseX = xbutton->x;
+    event.y = mouseY = xbutton->y;
+
+    // wheel is reported as buttons 4 and 5
+    if (xbutton->button == Button4 || xbutton->button == Button5) {
+        if (!down) return;
+        event.type = CB_EVENT_MOUSE_WHEEL;
+        event.wheel = xbutton->button == Button4 ? 1 : -1;
+        pushEvent(&event);
+        return;
+    }
+
+    event.button = convertMouse(xbutton->button);
+    pushEvent(&event);
+}
+
+// key release followed by press of same key is auto repeat
+// replaces event with that press and returns true
+static bool consumeRepeat(XEvent *event) {
+    if (event->type != KeyRelease || !XPending(display)) {
+        return false;
+    }
+
+    XEvent next;
+    XPeekEvent(display, &next);
+    if (next.type == KeyPress && next.xkey.time - event->xkey.time < 2 && next.xkey.keycode == event->xkey.keycode) {
+        // delete event
+        XNextEvent(display, event);
+        return true;
+    }
+    return false;
+}
+
+static void setViewport(void *data) {
+    int *size = data;
+    glViewport(0, 0, size[0], size[1]);
+}
+
+static void handleEvent(XEvent *event, bool repeat) {
+    cbKey key;
+    cbMouse mouse;
+    cbEvent input;
+
+    switch (event->type) {
+    case ConfigureNotify:
+        width = event->xconfigure.width;
+        height = event->xconfigure.height;
+        cbRenderSubmit(setViewport, (int[]) {width, height}, 2 * sizeof(int));
+        break;
+    case ClientMessage:
+        if (event->xclient.data.l[0] == closeWindowEvent) {
+            running = false;
+        }
+        break;
+    case KeyPress:
+        // repeated key is already down
+        key = convertKey(event->xkey.keycode);
+        if (key != CB_KEY_UNKNOWN) {
+            keyStates[key] = true;
+        }
+        pushKeyEvent(&event->xkey, CB_EVENT_KEY_DOWN, repeat);
+        break;
+    case KeyRelease:
+        key = convertKey(event->xkey.keycode);
+        if (key != CB_KEY_UNKNOWN) {
+            keyStates[key] = false;
+        }
+        pushKeyEvent(&event->xkey, CB_EVENT_KEY_UP, false);
+        break;
+    case ButtonPress:
+    case ButtonRelease:
+        mouse = convertMouse(event->xbutton.button);
+        if (mouse != CB_MOUSE_UNKNOWN) {
+            mouseStates[mouse] = event->type == ButtonPress;
+        }
+        pushButtonEvent(&event->xbutton, event->type == ButtonPress);
+        break;
+    case MotionNotify:
+        mouseX = event->xmotion.x;
+        mouseY = event->xmotion.y;
+        initEvent(&input, CB_EVENT_MOUSE_MOVE, event->xmotion.time);
+        input.x = mouseX;
+        input.y = mouseY;
+        pushEvent(&input);
+        break;
+    }
+}
+
+// pumps x events while engine is alive, blocks in XNextEvent
+static int inputThreadFunc(void *arg) {
+    XEvent event;
+    while (atomic_load(&inputRunning)) {
+        XNextEvent(display, &event);
+        if (event.type == ClientMessage && event.xclient.message_type == wakeInputEvent) {
+            continue; // sent by cbDestroy to stop thread
+        }
+
+        struct inputRecord record;
+        record.repeat = consumeRepeat(&event);
+        record.event = event;
+        while (!cbQueuePush(inputQueue, &record) && atomic_load(&inputRunning)) {
+            thrd_yield(); // frame is late, wait for drain
+        }
+    }
+    return 0;
+}
+
 void cbInit() {
+    // must be first xlib call
+    if (inputThreaded || renderThreaded) {
+        XInitThreads();
+    }
+
     // x11 display
     display = XOpenDisplay(NULL);
     if (!display) {
@@ -373,9 +621,165 @@ void cbInit() {
         printf("GLAD failed to load OpenGL functions\n");
 
     glEnable(GL_MULTISAMPLE);
+
+    // initial pointer position, then tracked with motion events
+    Window w;
+    int rootx, rooty;
+    unsigned int mask;
+    XQueryPointer(display, surface, &w, &w, &rootx, &rooty, &mouseX, &mouseY, &mask);
+
+    if (inputThreaded) {
+        wakeInputEvent = XInternAtom(display, "CB_WAKE_INPUT", False);
+        inputQueue = cbNewQueueFor(struct inputRecord, CB_INPUT_QUEUE_SIZE);
+        atomic_store(&inputRunning, true);
+        if (thrd_create(&inputThread, inputThreadFunc, NULL) != thrd_success) {
+            printf("input thread can not be started\n");
+            cbFreeQueue(inputQueue);
+            inputQueue = NULL;
+        }
+    }
+}
+
+// (re)create offscreen framebuffer storage
+static void resizeFramebuffer(void *data) {
+    int *size = data;
+    glBindRenderbuffer(GL_RENDERBUFFER, colorbuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, size[0], size[1]);
+    glBindRenderbuffer(GL_RENDERBUFFER, depthbuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, size[0], size[1]);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    glViewport(0, 0, size[0], size[1]);
+}
+
+void cbInitHeadless(int w, int h) {
+    headless = true;
+    width = w;
+    height = h;
+
+    // prefer mesa surfaceless platform, no display server needed
+    PFNEGLGETPLATFORMDISPLAYEXTPROC eglGetPlatformDisplayEXT = (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+    eglDisplay = EGL_NO_DISPLAY;
+    if (eglGetPlatformDisplayEXT != NULL) {
+        eglDisplay = eglGetPlatformDisplayEXT(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    }
+    if (eglDisplay == EGL_NO_DISPLAY) {
+        eglDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    }
+
+    EGLint eglMajor, eglMinor;
+    if (!eglInitialize(eglDisplay, &eglMajor, &eglMinor)) {
+        printf("EGL display can not be initialized\n");
+    }
+    eglBindAPI(EGL_OPENGL_API);
+
+    // find config
+    static const EGLint configAttribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_RED_SIZE, 8,
+        EGL_GREEN_SIZE, 8,
+        EGL_BLUE_SIZE, 8,
+        EGL_ALPHA_SIZE, 8,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint configCount;
+    if (!eglChooseConfig(eglDisplay, configAttribs, &config, 1, &configCount) || configCount == 0) {
+        printf("EGL no config matched\n");
+    }
+
+    // create context with attribs
+    static const EGLint contextAttribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 3,
+        EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    eglContext = eglCreateContext(eglDisplay, config, EGL_NO_CONTEXT, contextAttribs);
+    if (eglContext == EGL_NO_CONTEXT) {
+        printf("EGL context is 0\n");
+    }
+
+    // surfaceless if supported, else tiny pbuffer, rendering goes to framebuffer object anyway
+    if (!eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, eglContext)) {
+        static const EGLint pbufferAttribs[] = {
+            EGL_WIDTH, 1,
+            EGL_HEIGHT, 1,
+            EGL_NONE
+        };
+        eglSurface = eglCreatePbufferSurface(eglDisplay, config, pbufferAttribs);
+        if (!eglMakeCurrent(eglDisplay, eglSurface, eglSurface, eglContext)) {
+            printf("EGL context can not be made current\n");
+        }
+    }
+
+    // load OpenGL functions
+    if (!gladLoadGLLoader((GLADloadproc) eglGetProcAddress))
+        printf("GLAD failed to load OpenGL functions\n");
+
+    // offscreen framebuffer
+    glGenFramebuffers(1, &framebuffer);
+    glGenRenderbuffers(1, &colorbuffer);
+    glGenRenderbuffers(1, &depthbuffer);
+    resizeFramebuffer((int[]) {width, height});
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorbuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthbuffer);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        printf("offscreen framebuffer is not complete\n");
+    }
+}
+
+struct readPixelsCommand {
+    unsigned char *pixels;
+    int width, height; // size at time of call, main thread may resize later
+};
+
+static void readPixels(void *data) {
+    struct readPixelsCommand *read = data;
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, read->width, read->height, GL_RGBA, GL_UNSIGNED_BYTE, read->pixels);
+}
+
+void cbReadPixels(unsigned char *pixels) {
+    // after everything drawn this frame so far
+    struct readPixelsCommand read = {pixels, width, height};
+    cbRenderSubmit(readPixels, &read, sizeof(read));
+    cbRenderFinish();
 }
 
 void cbDestroy() {
+    cbProfileDestroyGpu();
+
+    if (headless) {
+        glDeleteFramebuffers(1, &framebuffer);
+        glDeleteRenderbuffers(1, &colorbuffer);
+        glDeleteRenderbuffers(1, &depthbuffer);
+        eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if (eglSurface != EGL_NO_SURFACE) {
+            eglDestroySurface(eglDisplay, eglSurface);
+        }
+        eglDestroyContext(eglDisplay, eglContext);
+        eglTerminate(eglDisplay);
+        return;
+    }
+
+    // wake input thread blocked in XNextEvent
+    if (inputQueue != NULL) {
+        atomic_store(&inputRunning, false);
+        XEvent wake;
+        memset(&wake, 0, sizeof(wake));
+        wake.xclient.type = ClientMessage;
+        wake.xclient.window = surface;
+        wake.xclient.message_type = wakeInputEvent;
+        wake.xclient.format = 32;
+        XSendEvent(display, surface, False, NoEventMask, &wake);
+        XFlush(display);
+        thrd_join(inputThread, NULL);
+        cbFreeQueue(inputQueue);
+        inputQueue = NULL;
+    }
+
     glXMakeCurrent(display, 0, 0);
     glXDestroyContext(display, context);
     XDestroyWindow(display, surface);
@@ -391,6 +795,95 @@ void cbOnUpdate(void (*func)(float)) {
     onUpdateFunc = func;
 }
 
+void cbOnRender(void (*func)(float)) {
+    onRenderFunc = func;
+}
+
+void cbSetFixedTimestep(int hz) {
+    fixedStep = hz > 0 ? 1.0 / hz : 0.0;
+}
+
+void cbSetMaxUpdateSteps(int steps) {
+    maxUpdateSteps = steps > 0 ? steps : 1;
+}
+
+bool cbSetSwapInterval(int interval) {
+    if (headless) return false; // no surface to swap
+
+    const char *extensions = glXQueryExtensionsString(display, DefaultScreen(display));
+    if (interval < 0 && !strstr(extensions, "GLX_EXT_swap_control_tear")) {
+        interval = 1; // adaptive not supported, use vsync
+    }
+
+    if (strstr(extensions, "GLX_EXT_swap_control")) {
+        glXSwapIntervalEXTProc glXSwapIntervalEXT = (glXSwapIntervalEXTProc) glXGetProcAddressARB((const GLubyte*) "glXSwapIntervalEXT");
+        if (glXSwapIntervalEXT != NULL) {
+            glXSwapIntervalEXT(display, surface, interval);
+            return true;
+        }
+    }
+    if (strstr(extensions, "GLX_MESA_swap_control") && interval >= 0) {
+        glXSwapIntervalMESAProc glXSwapIntervalMESA = (glXSwapIntervalMESAProc) glXGetProcAddressARB((const GLubyte*) "glXSwapIntervalMESA");
+        if (glXSwapIntervalMESA != NULL) {
+            return glXSwapIntervalMESA(interval) == 0;
+        }
+    }
+    return false;
+}
+
+void cbSetFrameLimit(int fps) {
+    framePeriod = fps > 0 ? 1000000000LL / fps : 0;
+    frameDeadline = 0;
+}
+
+void cbGetFrameStats(cbFrameStats *stats) {
+    *stats = frameStats;
+}
+
+void cbResetFrameStats() {
+    memset(&frameStats, 0, sizeof(frameStats));
+    frameTimeM2 = 0.0;
+    limiterErrorSum = 0.0;
+    limiterSamples = 0;
+}
+
+static void recordFrameTime(double delta) {
+    // running mean and variance
+    frameStats.frames++;
+    double diff = delta - frameStats.frameTime;
+    frameStats.frameTime += diff / frameStats.frames;
+    frameTimeM2 += diff * (delta - frameStats.frameTime);
+    frameStats.jitter = frameStats.frames > 1 ? sqrt(frameTimeM2 / (frameStats.frames - 1)) : 0.0;
+    if (delta > frameStats.maxFrameTime) {
+        frameStats.maxFrameTime = delta;
+    }
+}
+
+// wait until frame deadline, coarse sleep then spin for precision
+static void limitFrame() {
+    if (framePeriod == 0) return;
+
+    long long now = cbNanoTime();
+    frameDeadline += framePeriod;
+    if (frameDeadline < now - framePeriod) {
+        frameDeadline = now; // too late, do not try to catch up
+        return;
+    }
+
+    long long wake = frameDeadline - CB_FRAME_SPIN_NS;
+    if (wake > now) {
+        struct timespec t;
+        t.tv_sec = wake / 1000000000LL;
+        t.tv_nsec = wake % 1000000000LL;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) == EINTR); // restart only if interrupted, on other errors spin below
+    }
+    while ((now = cbNanoTime()) < frameDeadline);
+
+    // how late we woke up
+    limiterErrorSum += (double) (now - frameDeadline) * 1.0e-9;
+    frameStats.limiterError = limiterErrorSum / ++limiterSamples;
+}
+
 void cbOnStop(void (*func)(void)) {
     onStopFunc = func;
 }
@@ -403,6 +896,10 @@ void cbGetSize(int *w, int *h) {
 void cbSetSize(int w, int h) {
     width = w;
     height = h;
+    if (headless) {
+        cbRenderSubmit(resizeFramebuffer, (int[]) {w, h}, 2 * sizeof(int));
+        return;
+    }
     XResizeWindow(display, surface, w, h);
 }
 
@@ -412,6 +909,7 @@ const char* cbGetTitle() {
 
 void cbSetTitle(const char* t) {
     snprintf(title, 255, "%s", t);
+    if (headless) return;
     XStoreName(display, surface, title);
 }
 
@@ -424,82 +922,139 @@ bool cbIsMouseDown(cbMouse m) {
 }
 
 void cbGetMousePos(int *x, int *y) {
-    Window w;
-    int rootx, rooty, mx, my;
-    unsigned int mask;
-    XQueryPointer(display, surface, &w, &w, &rootx, &rooty, &mx, &my, &mask);
-    *x = mx;
-    *y = my;
+    *x = mouseX;
+    *y = mouseY;
 }
 
 void cbSetMousePos(int x, int y) {
+    mouseX = x;
+    mouseY = y;
+    if (headless) return;
     XWarpPointer(display, None, surface, 0, 0, 0, 0, x, y);
     preventMouseLoop = true;
 }
 
+void cbSetInputThread(bool enable) {
+    inputThreaded = enable;
+}
+
+void cbSetRenderThread(bool enable) {
+    renderThreaded = enable;
+}
+
+bool cbPollEvent(cbEvent *event) {
+    if (eventCount == 0) {
+        return false;
+    }
+    *event = eventQueue[eventHead];
+    eventHead = (eventHead + 1) % CB_EVENT_QUEUE_SIZE;
+    eventCount--;
+    return true;
+}
+
+// moves context to calling thread or releases it
+static void bindContext(bool current) {
+    if (headless) {
+        if (current) {
+            eglMakeCurrent(eglDisplay, eglSurface, eglSurface, eglContext);
+        } else {
+            eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        }
+        return;
+    }
+    if (current) {
+        glXMakeCurrent(display, surface, context);
+    } else {
+        glXMakeCurrent(display, None, NULL);
+    }
+}
+
+static void present() {
+    cbProfileBegin("swap");
+    if (headless) {
+        glFinish(); // wait frame like swap does
+    } else {
+        glXSwapBuffers(display, surface);
+    }
+    cbProfileEnd();
+    cbProfileGpuFrame();
+}
+
 void cbRun() {
     onStartFunc();
     running = true;
 
-    bool keyRepeating; // prevent keyboard repeating
+    // resources are created by onStart, context moves to render thread after
+    if (renderThreaded) {
+        cbStartRenderThread(bindContext, present);
+    }
 
     // measure frame time
     struct timespec start, end;
     clock_gettime(CLOCK_MONOTONIC, &start);
+    double accumulator = 0.0;
+    bool firstFrame = true; // has no previous frame to measure
+    frameDeadline = cbNanoTime();
 
     XEvent event;
     while (running) {
 
         end = start;
         clock_gettime(CLOCK_MONOTONIC, &start);
+        cbProfileFrame();
 
-        while (XPending(display)) {
-            XNextEvent(display, &event);
-            switch (event.type) {
-            case ConfigureNotify:
-                width = event.xconfigure.width;
-                height = event.xconfigure.height;
-                glViewport(0, 0, width, height);
-                break;
-            case ClientMessage:
-                if (event.xclient.data.l[0] == closeWindowEvent) {
-                    running = false;
-                }
-                break;
-            case KeyPress:
-                keyStates[convertKey(event.xkey.keycode)] = true;
-                break;
-            case KeyRelease:
-                keyRepeating = false;
-                if (XPending(display)) {
-                    XEvent next;
-                    XPeekEvent(display, &next);
-
-                    if (next.type == KeyPress && next.xkey.time - event.xkey.time < 2 && next.xkey.keycode == event.xkey.keycode) {
-                        // delete event
-                        XNextEvent (display, &event);
-                        keyRepeating = true;
-                    }
-                }
-
-                if (!keyRepeating) {
-                    keyStates[convertKey(event.xkey.keycode)] = false;
-                }
-                break;
-            case ButtonPress:
-                mouseStates[convertMouse(event.xbutton.button)] = true;
-                break;
-            case ButtonRelease:
-                mouseStates[convertMouse(event.xbutton.button)] = false;
-                break;
+        cbProfileBegin("events");
+        if (inputQueue != NULL) {
+            // sampled by input thread
+            struct inputRecord record;
+            while (cbQueuePop(inputQueue, &record)) {
+                handleEvent(&record.event, record.repeat);
+            }
+        } else {
+            while (!headless && XPending(display)) {
+                XNextEvent(display, &event);
+                bool repeat = consumeRepeat(&event);
+                handleEvent(&event, repeat);
             }
         }
+        cbProfileEnd();
 
-        float delta = (float) (double)(start.tv_sec - end.tv_sec) + ((double)(start.tv_nsec - end.tv_nsec) * 1.0e-9);
-        onUpdateFunc(delta);
-        glXSwapBuffers(display, surface);
+        double delta = (double)(start.tv_sec - end.tv_sec) + ((double)(start.tv_nsec - end.tv_nsec) * 1.0e-9);
+        if (!firstFrame) {
+            recordFrameTime(delta);
+        }
+        firstFrame = false;
+        float alpha = 1.0f;
+        if (fixedStep > 0.0) {
+            // drop time we can not simulate, prevents spiral of death
+            accumulator += delta;
+            if (accumulator > fixedStep * maxUpdateSteps) {
+                accumulator = fixedStep * maxUpdateSteps;
+            }
+
+            // zero or more steps per frame
+            while (accumulator >= fixedStep) {
+                CB_PROFILE("update") onUpdateFunc((float) fixedStep);
+                accumulator -= fixedStep;
+            }
+            alpha = (float) (accumulator / fixedStep);
+        } else {
+            CB_PROFILE("update") onUpdateFunc((float) delta);
+        }
+        if (onRenderFunc) {
+            CB_PROFILE("render") onRenderFunc(alpha);
+        }
+
+        if (cbRenderIsThreaded()) {
+            CB_PROFILE("handoff") cbRenderFrame();
+        } else {
+            present();
+        }
+        cbRenderStatsFrame();
+        CB_PROFILE("limiter") limitFrame();
     }
 
+    cbStopRenderThread();
     onStopFunc();
 }
 
@@ -117,15 +117,93 @@ typedef enum {
     CB_KEY_TOTAL // count
 } cbKey;
 
+typedef enum {
+    CB_EVENT_KEY_DOWN = 0,
+    CB_EVENT_KEY_UP,
+    CB_EVENT_MOUSE_DOWN,
+    CB_EVENT_MOUSE_UP,
+    CB_EVENT_MOUSE_MOVE,
+    CB_EVENT_MOUSE_WHEEL,
+    CB_EVENT_TEXT
+} cbEventType;
+
+typedef struct {
+    cbEventType type;
+    unsigned long time; // milliseconds, window system time
+    cbKey key; // key down/up
+    bool repeat; // key down from auto repeat
+    cbMouse button; // mouse down/up
+    int x, y; // mouse position
+    int wheel; // 1 - up, -1 - down
+    unsigned int codepoint; // text
+} cbEvent;
+
+// unread events kept, when full mouse moves are dropped first, then oldest
+#ifndef CB_EVENT_QUEUE_SIZE
+    #define CB_EVENT_QUEUE_SIZE 256
+#endif
+
+// x events buffered by input thread
+#ifndef CB_INPUT_QUEUE_SIZE
+    #define CB_INPUT_QUEUE_SIZE 1024
+#endif
+
 // init/destroy engine
 void cbInit();
 void cbDestroy();
 
+// pump window events on separate thread, call before cbInit
+// events are handed to cbRun at frame start, long frames do not delay input sampling
+void cbSetInputThread(bool enable);
+
+// execute gl commands on separate thread, call before cbInit
+// frame is recorded while previous one is executed, resources made in onStart are shared
+// own gl calls must go through cbRenderSubmit or cbRenderCall while cbRun is running
+void cbSetRenderThread(bool enable);
+
+// init engine without window, renders to offscreen framebuffer of w,h size
+// no display server needed, use instead of cbInit
+void cbInitHeadless(int w, int h);
+
+// read current framebuffer, pixels is width * height * 4 rgba bytes
+void cbReadPixels(unsigned char *pixels);
+
 // callbacks
 void cbOnStart(void (*func)(void));
 void cbOnUpdate(void (*func)(float));
 void cbOnStop(void (*func)(void));
 
+// optional render callback, called once per frame after updates
+// receives interpolation alpha between previous and current simulation state
+// alpha is always 1 with variable timestep
+void cbOnRender(void (*func)(float));
+
+// run update with fixed step hz times per second, 0 - once per frame with variable delta
+// frame may run several updates or none
+void cbSetFixedTimestep(int hz);
+
+// max updates per frame, slower simulation is dropped (default 5)
+void cbSetMaxUpdateSteps(int steps);
+
+// vsync, 0 - off, 1 - every vertical blank, -1 - adaptive (late frames are not delayed)
+// adaptive falls back to 1 if not supported, returns false if interval can not be set
+bool cbSetSwapInterval(int interval);
+
+// limit frame rate with sleep, 0 - unlimited
+void cbSetFrameLimit(int fps);
+
+// measured since start or last reset, in seconds
+typedef struct {
+    int frames;
+    double frameTime; // mean
+    double jitter; // standard deviation of frame time
+    double maxFrameTime;
+    double limiterError; // mean time limiter woke after deadline
+} cbFrameStats;
+
+void cbGetFrameStats(cbFrameStats *stats);
+void cbResetFrameStats();
+
 // window width, height, title
 void cbGetSize(int *w, int *h);
 void cbSetSize(int w, int h);
@@ -138,6 +216,10 @@ bool cbIsMouseDown(cbMouse m);
 void cbGetMousePos(int *x, int *y);
 void cbSetMousePos(int x, int y);
 
+// events in order received, returns false when queue is empty
+// key and mouse states above are updated as well
+bool cbPollEvent(cbEvent *event);
+
 // enter/exit main cycle
 void cbRun();
 void cbExit();
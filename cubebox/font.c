@@ -1,11 +1,15 @@
 #include "font.h"
 #include "engine.h"
 #include "utils.h"
+#include "profile.h"
+#include "render.h"
+#include "job.h"
 #include "glad.h"
 #include "linmath.h"
 #include "stretchy_buffer.h"
 #include "stb_rect_pack.h"
 #include "stb_truetype.h"
+#include "tinycthread.h"
 
 #include <assert.h>
 #include <stdio.h>
@@ -13,6 +17,11 @@
 #include <stdbool.h>
 #include <inttypes.h>
 
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 // UTF-8 decoder
 // Copyright (c) 2008-2009 Bjoern Hoehrmann <bjoern@hoehrmann.de>
 // See http://bjoern.hoehrmann.de/utf-8/decoder/dfa/ for details.
@@ -50,9 +59,14 @@ static uint32_t decode(uint32_t* state, uint32_t* codep, uint32_t byte) {
 // UTF-8 decoder
 
 // texture with FONT_CACHE_SIZE width and height
-// modifies gl texture itself
+// glyphs are rasterized to cpu copy and uploaded in batches
 struct cbFontTexture {
     GLuint id;
+    // cpu shadow of gl texture
+    unsigned char *pixels; // CB_FONT_CACHE_SIZE * CB_FONT_CACHE_SIZE
+    // region not uploaded yet
+    bool dirty;
+    int dirtyX0, dirtyY0, dirtyX1, dirtyY1;
     // glyph packer
     stbrp_context *packer;
     stbrp_node *nodes; // CB_FONT_CACHE_SIZE size
@@ -67,71 +81,185 @@ struct cbFontGlyph {
     float advance, xOffset, yOffset;
 };
 
+// font file shared between sizes
+struct cbFontFace {
+    dev_t device; // file identity
+    ino_t inode;
+    int refs; // fonts using this face
+    bool mapped; // mmap or malloc
+    unsigned char *data;
+    size_t size;
+    bool hashed; // hash is computed on first cache use
+    uint32_t hash;
+};
+
 struct cbFontImpl {
     cbFont id;
     int size;
 
     stbtt_fontinfo stbFont;
-    unsigned char *fontData;
+    int face; // index in faces
 
     struct cbFontGlyph *glyphs;  // stretchy buffer
     struct cbFontTexture *textures; // stretchy buffer
+
+    // open addressing index of glyphs by codepoint
+    int *lookup; // glyph index + 1, 0 is empty
+    int lookupSize; // power of two
 };
 
-static unsigned char *emptyData = NULL; // black image
+// glyph waiting for rasterization
+struct cbFontPending {
+    cbFont font;
+    int glyph; // index in font glyphs
+    int texture; // index in font textures
+    int index; // truetype glyph index
+};
+
+static struct cbFontFace *faces = NULL; // stretchy buffer
 static struct cbFontImpl *fonts = NULL; // stretchy buffer
+static struct cbFontPending *pendingGlyphs = NULL; // stretchy buffer
+
+// find already loaded face or map font file
+static int loadFace(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        printf("font file %s can not be opened\n", path);
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    // reuse face of same file
+    for (int i = 0; i < sb_count(faces); i++) {
+        if (faces[i].refs > 0 && faces[i].device == st.st_dev && faces[i].inode == st.st_ino) {
+            close(fd);
+            faces[i].refs++;
+            return i;
+        }
+    }
+
+    struct cbFontFace face;
+    face.device = st.st_dev;
+    face.inode = st.st_ino;
+    face.refs = 1;
+    face.size = (size_t) st.st_size;
+    face.hashed = false;
+
+    // map read only, pages are shared with page cache
+    face.mapped = true;
+    face.data = mmap(NULL, face.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (face.data == MAP_FAILED) {
+        // fallback to reading whole file
+        face.mapped = false;
+        face.data = malloc(face.size);
+        if (read(fd, face.data, face.size) != (ssize_t) face.size) {
+            printf("font file %s can not be read\n", path);
+            free(face.data);
+            close(fd);
+            return -1;
+        }
+    }
+    close(fd);
+
+    // reuse slot of released face
+    for (int i = 0; i < sb_count(faces); i++) {
+        if (faces[i].refs == 0) {
+            faces[i] = face;
+            return i;
+        }
+    }
+    sb_push(faces, face);
+    return sb_count(faces) - 1;
+}
+
+static void releaseFace(int id) {
+    struct cbFontFace* face = &faces[id];
+    if (--face->refs > 0) return; // still used
+
+    if (face->mapped) {
+        munmap(face->data, face->size);
+    } else {
+        free(face->data);
+    }
+    face->data = NULL;
+}
 
 cbFont cbLoadFont(const char *path, int size) {
     struct cbFontImpl font;
     font.size = size;
     font.glyphs = NULL;
     font.textures = NULL;
+    font.lookup = NULL;
+    font.lookupSize = 0;
     font.id = sb_count(fonts);
 
-    // read font file
-    FILE *fontFile = fopen(path, "r");
-    fseek(fontFile, 0, SEEK_END);
-    int fontDataSize = (int) ftell(fontFile);
-    fseek(fontFile, 0, SEEK_SET);
-    font.fontData = malloc(fontDataSize);
-    fread(font.fontData, 1, fontDataSize, fontFile);
-    fclose(fontFile);
+    // font file is loaded once for all sizes
+    font.face = loadFace(path);
+    if (font.face == -1) {
+        return -1;
+    }
 
-    stbtt_InitFont(&font.stbFont, font.fontData, 0);
+    stbtt_InitFont(&font.stbFont, faces[font.face].data, 0);
     sb_push(fonts, font);
 
     return font.id;
 }
 
-void cbDestroyFont(cbFont id) {
-    if (id == -1) return; // was deleted
-    struct cbFontImpl* font = &fonts[id];
-    if (font->id == -1) return; // second check
+static void deleteTexture(void *arg) {
+    glDeleteTextures(1, (GLuint*) arg);
+}
 
-    free(font->fontData);
+// free glyphs and textures
+static void clearGlyphs(struct cbFontImpl* font) {
     for (int i = 0; i < sb_count(font->textures); i++) {
-        glDeleteTextures(1, &font->textures[i].id);
+        cbRenderSubmit(deleteTexture, &font->textures[i].id, sizeof(GLuint));
+        free(font->textures[i].pixels);
         free(font->textures[i].packer);
         free(font->textures[i].nodes);
     }
 
     sb_free(font->textures);
     sb_free(font->glyphs);
+    free(font->lookup);
+    font->textures = NULL;
+    font->glyphs = NULL;
+    font->lookup = NULL;
+    font->lookupSize = 0;
+}
+
+void cbDestroyFont(cbFont id) {
+    if (id == -1) return; // was deleted
+    struct cbFontImpl* font = &fonts[id];
+    if (font->id == -1) return; // second check
+
+    releaseFace(font->face);
+    clearGlyphs(font);
     font->id = -1; // mark as deleted
 }
 
-static struct cbFontTexture* createFontTexture(struct cbFontImpl* font) {
-    struct cbFontTexture fontTexture;
+static void createTexture(void *arg) {
+    struct cbFontTexture *fontTexture = arg;
 
     // create texture
-    glGenTextures(1, &fontTexture.id);
-    glBindTexture(GL_TEXTURE_2D, fontTexture.id);
+    glGenTextures(1, &fontTexture->id);
+    glBindTexture(GL_TEXTURE_2D, fontTexture->id);
     glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, CB_FONT_CACHE_SIZE, CB_FONT_CACHE_SIZE, 0, GL_RED, GL_UNSIGNED_BYTE, emptyData);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, CB_FONT_CACHE_SIZE, CB_FONT_CACHE_SIZE, 0, GL_RED, GL_UNSIGNED_BYTE, fontTexture->pixels);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+}
+
+static struct cbFontTexture* createFontTexture(struct cbFontImpl* font) {
+    struct cbFontTexture fontTexture;
+    fontTexture.pixels = calloc(CB_FONT_CACHE_SIZE * CB_FONT_CACHE_SIZE, 1);
+    fontTexture.dirty = false;
+    cbRenderCall(createTexture, &fontTexture); // id is needed now
 
     // init glyph packer
     fontTexture.packer = malloc(sizeof(stbrp_context));
@@ -142,12 +270,46 @@ static struct cbFontTexture* createFontTexture(struct cbFontImpl* font) {
     return &font->textures[sb_count(font->textures) - 1]; // return pointer
 }
 
+static int findGlyph(struct cbFontImpl* font, unsigned int codepoint) {
+    if (font->lookupSize == 0) return -1;
+
+    unsigned int mask = font->lookupSize - 1;
+    for (unsigned int i = (codepoint * 2654435761u) & mask; font->lookup[i] != 0; i = (i + 1) & mask) {
+        if (font->glyphs[font->lookup[i] - 1].codepoint == codepoint) {
+            return font->lookup[i] - 1;
+        }
+    }
+    return -1;
+}
+
+// index last pushed glyph
+static void indexGlyph(struct cbFontImpl* font) {
+    int count = sb_count(font->glyphs);
+    int first = count - 1;
+
+    // keep load factor under half
+    if (count * 2 > font->lookupSize) {
+        free(font->lookup);
+        font->lookupSize = font->lookupSize == 0 ? 64 : font->lookupSize * 2;
+        font->lookup = calloc(font->lookupSize, sizeof(int));
+        first = 0; // reindex all glyphs
+    }
+
+    unsigned int mask = font->lookupSize - 1;
+    for (int g = first; g < count; g++) {
+        unsigned int i = (font->glyphs[g].codepoint * 2654435761u) & mask;
+        while (font->lookup[i] != 0) {
+            i = (i + 1) & mask;
+        }
+        font->lookup[i] = g + 1;
+    }
+}
+
 static struct cbFontGlyph* loadGlyph(struct cbFontImpl* font, unsigned int codepoint) {
     // find glyph if exists
-    for (int i = 0; i < sb_count(font->glyphs); i++) {
-        if (font->glyphs[i].codepoint == codepoint) {
-            return &font->glyphs[i];
-        }
+    int found = findGlyph(font, codepoint);
+    if (found != -1) {
+        return &font->glyphs[found];
     }
 
     // get metrics
@@ -194,18 +356,394 @@ static struct cbFontGlyph* loadGlyph(struct cbFontImpl* font, unsigned int codep
     glyph.xOffset = (float) x0;
     glyph.yOffset = (float) y0;
     sb_push(font->glyphs, glyph);
-
-    // modify texture
-    unsigned char *bitmap = malloc(gw * gh);
-    stbtt_MakeGlyphBitmap(&font->stbFont, bitmap, gw, gh, gw, scale, scale, gIndex);
-	glBindTexture(GL_TEXTURE_2D, texture->id);
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-	glTexSubImage2D(GL_TEXTURE_2D, 0, glyph.x0, glyph.y0, gw, gh, GL_RED, GL_UNSIGNED_BYTE, bitmap);
-    free(bitmap);
+    indexGlyph(font);
+
+    // rasterize later with other glyphs of this frame
+    if (gw > 0 && gh > 0) {
+        struct cbFontPending pending;
+        pending.font = font->id;
+        pending.glyph = sb_count(font->glyphs) - 1;
+        pending.texture = (int) (texture - font->textures);
+        pending.index = gIndex;
+        sb_push(pendingGlyphs, pending);
+    }
+    cbRenderStatsCurrent()->glyphMisses++;
 
     return &font->glyphs[sb_count(font->glyphs) - 1];
 }
 
+static void rasterizeGlyphs(struct cbFontPending *pending, int count) {
+    for (int i = 0; i < count; i++) {
+        struct cbFontImpl* font = &fonts[pending[i].font];
+        if (font->id == -1) continue; // font was deleted
+
+        struct cbFontGlyph* glyph = &font->glyphs[pending[i].glyph];
+        struct cbFontTexture* texture = &font->textures[pending[i].texture];
+        float scale = stbtt_ScaleForPixelHeight(&font->stbFont, font->size);
+
+        // draw directly to atlas, packed rects do not overlap
+        unsigned char *output = texture->pixels + glyph->y0 * CB_FONT_CACHE_SIZE + glyph->x0;
+        stbtt_MakeGlyphBitmap(&font->stbFont, output, glyph->x1 - glyph->x0, glyph->y1 - glyph->y0, CB_FONT_CACHE_SIZE, scale, scale, pending[i].index);
+    }
+}
+
+static void rasterizeRange(void *data, int start, int end) {
+    struct cbFontPending *pending = data;
+    rasterizeGlyphs(pending + start, end - start);
+}
+
+#if CB_FONT_RASTER_THREADS > 1
+struct rasterizeJob {
+    struct cbFontPending *pending;
+    int count;
+};
+
+static int rasterizeThread(void *arg) {
+    struct rasterizeJob* job = arg;
+    rasterizeGlyphs(job->pending, job->count);
+    return 0;
+}
+#endif
+
+struct uploadCommand {
+    GLuint texture;
+    int x, y, w, h;
+    int stride;
+    unsigned char *pixels;
+    bool owned; // pixels is copy
+};
+
+static void uploadPixels(void *arg) {
+    struct uploadCommand *upload = arg;
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, upload->stride);
+    glBindTexture(GL_TEXTURE_2D, upload->texture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, upload->x, upload->y, upload->w, upload->h, GL_RED, GL_UNSIGNED_BYTE, upload->pixels);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    if (upload->owned) {
+        free(upload->pixels);
+    }
+}
+
+// uploads atlas region from cpu copy
+static void uploadRegion(struct cbFontTexture* texture, int x0, int y0, int x1, int y1) {
+    struct uploadCommand upload;
+    upload.texture = texture->id;
+    upload.x = x0;
+    upload.y = y0;
+    upload.w = x1 - x0;
+    upload.h = y1 - y0;
+
+    unsigned char *region = texture->pixels + y0 * CB_FONT_CACHE_SIZE + x0;
+    if (cbRenderIsThreaded()) {
+        // atlas may change before render thread uploads it
+        upload.stride = upload.w;
+        upload.pixels = malloc(upload.w * upload.h);
+        upload.owned = true;
+        for (int row = 0; row < upload.h; row++) {
+            memcpy(upload.pixels + row * upload.w, region + row * CB_FONT_CACHE_SIZE, upload.w);
+        }
+    } else {
+        upload.stride = CB_FONT_CACHE_SIZE;
+        upload.pixels = region;
+        upload.owned = false;
+    }
+    cbRenderSubmit(uploadPixels, &upload, sizeof(upload));
+
+    cbRenderStats *stats = cbRenderStatsCurrent();
+    stats->bytesUploaded += upload.w * upload.h;
+    stats->textureBinds++;
+}
+
+// rasterize pending glyphs and upload one rectangle per texture
+static void updateGlyphs() {
+    int count = sb_count(pendingGlyphs);
+    if (count == 0)
+        return;
+
+    cbProfileBegin("font glyphs");
+
+    if (cbJobThreadCount() > 1) {
+        // job system is running, share its workers
+        cbJobParallelFor(rasterizeRange, pendingGlyphs, count, 8);
+    } else {
+#if CB_FONT_RASTER_THREADS > 1
+        if (count >= CB_FONT_RASTER_THREADS * 4) {
+            // split glyphs between threads, this thread takes first part
+            thrd_t threads[CB_FONT_RASTER_THREADS];
+            struct rasterizeJob jobs[CB_FONT_RASTER_THREADS];
+            bool started[CB_FONT_RASTER_THREADS];
+            int part = (count + CB_FONT_RASTER_THREADS - 1) / CB_FONT_RASTER_THREADS;
+            for (int i = 1; i < CB_FONT_RASTER_THREADS; i++) {
+                int start = i * part;
+                jobs[i].pending = pendingGlyphs + start;
+                jobs[i].count = count - start < part ? count - start : part;
+                started[i] = jobs[i].count > 0 && thrd_create(&threads[i], rasterizeThread, &jobs[i]) == thrd_success;
+                if (!started[i] && jobs[i].count > 0) {
+                    rasterizeGlyphs(jobs[i].pending, jobs[i].count); // no thread, do it here
+                }
+            }
+            rasterizeGlyphs(pendingGlyphs, part);
+            for (int i = 1; i < CB_FONT_RASTER_THREADS; i++) {
+                if (started[i]) {
+                    thrd_join(threads[i], NULL);
+                }
+            }
+        } else {
+            rasterizeGlyphs(pendingGlyphs, count);
+        }
+#else
+        rasterizeGlyphs(pendingGlyphs, count);
+#endif
+    }
+
+    // grow dirty regions
+    for (int i = 0; i < count; i++) {
+        struct cbFontImpl* font = &fonts[pendingGlyphs[i].font];
+        if (font->id == -1) continue;
+
+        struct cbFontGlyph* glyph = &font->glyphs[pendingGlyphs[i].glyph];
+        struct cbFontTexture* texture = &font->textures[pendingGlyphs[i].texture];
+        if (!texture->dirty) {
+            texture->dirty = true;
+            texture->dirtyX0 = glyph->x0;
+            texture->dirtyY0 = glyph->y0;
+            texture->dirtyX1 = glyph->x1;
+            texture->dirtyY1 = glyph->y1;
+        } else {
+            if (glyph->x0 < texture->dirtyX0) texture->dirtyX0 = glyph->x0;
+            if (glyph->y0 < texture->dirtyY0) texture->dirtyY0 = glyph->y0;
+            if (glyph->x1 > texture->dirtyX1) texture->dirtyX1 = glyph->x1;
+            if (glyph->y1 > texture->dirtyY1) texture->dirtyY1 = glyph->y1;
+        }
+    }
+
+    // upload dirty regions
+    for (int i = 0; i < count; i++) {
+        struct cbFontImpl* font = &fonts[pendingGlyphs[i].font];
+        if (font->id == -1) continue;
+
+        struct cbFontTexture* texture = &font->textures[pendingGlyphs[i].texture];
+        if (!texture->dirty) continue; // already uploaded
+
+        uploadRegion(texture, texture->dirtyX0, texture->dirtyY0, texture->dirtyX1, texture->dirtyY1);
+        texture->dirty = false;
+    }
+
+    sb_free(pendingGlyphs);
+    pendingGlyphs = NULL;
+    cbProfileEnd();
+}
+
+void cbFontPrewarm(cbFont id, const unsigned int *codepoints, int count) {
+    struct cbFontImpl* font = &fonts[id];
+    for (int i = 0; i < count; i++) {
+        loadGlyph(font, codepoints[i]);
+    }
+    updateGlyphs();
+}
+
+bool cbFontPrewarmFile(cbFont id, const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return false;
+    }
+
+    struct cbFontImpl* font = &fonts[id];
+    uint32_t state = 0, codepoint;
+    int byte;
+    while ((byte = fgetc(file)) != EOF) {
+        if (decode(&state, &codepoint, (uint32_t) byte)) {
+            continue; // not unicode char yet
+        }
+        if (codepoint < 0x20) {
+            continue; // skip line breaks and control chars
+        }
+        loadGlyph(font, codepoint);
+    }
+    fclose(file);
+
+    updateGlyphs();
+    return true;
+}
+
+// font cache file, native byte order
+#define CB_FONT_CACHE_MAGIC 0x43464243 // CBFC
+#define CB_FONT_CACHE_VERSION 1
+#define CB_FONT_CACHE_MAX_GLYPHS (1 << 20) // sanity limits for counts read from file
+#define CB_FONT_CACHE_MAX_TEXTURES 256
+
+struct cbFontCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t atlasSize; // CB_FONT_CACHE_SIZE
+    uint32_t fontSize;
+    uint32_t faceSize; // font file identity
+    uint32_t faceHash;
+    uint32_t glyphCount;
+    uint32_t textureCount;
+};
+
+struct cbFontCacheGlyph {
+    uint32_t codepoint;
+    uint32_t texture; // index in font textures
+    int32_t x0, y0, x1, y1;
+    float advance, xOffset, yOffset;
+};
+
+// FNV-1a of font file, once per face as it touches every page
+static uint32_t hashFace(struct cbFontFace* face) {
+    if (!face->hashed) {
+        face->hash = 2166136261u;
+        for (size_t i = 0; i < face->size; i++) {
+            face->hash = (face->hash ^ face->data[i]) * 16777619u;
+        }
+        face->hashed = true;
+    }
+    return face->hash;
+}
+
+static void fillCacheHeader(struct cbFontImpl* font, struct cbFontCacheHeader *header) {
+    header->magic = CB_FONT_CACHE_MAGIC;
+    header->version = CB_FONT_CACHE_VERSION;
+    header->atlasSize = CB_FONT_CACHE_SIZE;
+    header->fontSize = font->size;
+    header->faceSize = (uint32_t) faces[font->face].size;
+    header->faceHash = hashFace(&faces[font->face]);
+    header->glyphCount = sb_count(font->glyphs);
+    header->textureCount = sb_count(font->textures);
+}
+
+bool cbSaveFontCache(cbFont id, const char *path) {
+    struct cbFontImpl* font = &fonts[id];
+    updateGlyphs(); // rasterize pending glyphs to atlas
+
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        return false;
+    }
+
+    struct cbFontCacheHeader header;
+    fillCacheHeader(font, &header);
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+
+    // glyphs in packing order
+    for (int i = 0; ok && i < sb_count(font->glyphs); i++) {
+        struct cbFontGlyph* glyph = &font->glyphs[i];
+        struct cbFontCacheGlyph cached;
+        cached.codepoint = glyph->codepoint;
+        cached.texture = 0;
+        for (int t = 0; t < sb_count(font->textures); t++) {
+            if (font->textures[t].id == glyph->texture) {
+                cached.texture = t;
+            }
+        }
+        cached.x0 = glyph->x0;
+        cached.y0 = glyph->y0;
+        cached.x1 = glyph->x1;
+        cached.y1 = glyph->y1;
+        cached.advance = glyph->advance;
+        cached.xOffset = glyph->xOffset;
+        cached.yOffset = glyph->yOffset;
+        ok = fwrite(&cached, sizeof(cached), 1, file) == 1;
+    }
+
+    // atlas pages
+    for (int i = 0; ok && i < sb_count(font->textures); i++) {
+        ok = fwrite(font->textures[i].pixels, CB_FONT_CACHE_SIZE * CB_FONT_CACHE_SIZE, 1, file) == 1;
+    }
+
+    if (fclose(file) != 0) {
+        ok = false;
+    }
+    return ok;
+}
+
+bool cbLoadFontCache(cbFont id, const char *path) {
+    struct cbFontImpl* font = &fonts[id];
+    if (sb_count(font->glyphs) != 0) {
+        return false; // only for fresh fonts
+    }
+
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return false;
+    }
+
+    // cache must match font file and size
+    struct cbFontCacheHeader header, expected;
+    fillCacheHeader(font, &expected);
+    if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != expected.magic ||
+        header.version != expected.version || header.atlasSize != expected.atlasSize ||
+        header.fontSize != expected.fontSize || header.faceSize != expected.faceSize ||
+        header.faceHash != expected.faceHash) {
+        fclose(file);
+        return false;
+    }
+
+    // counts come from file, check them against its size before allocating
+    struct stat st;
+    size_t pageSize = (size_t) CB_FONT_CACHE_SIZE * CB_FONT_CACHE_SIZE;
+    if (header.glyphCount > CB_FONT_CACHE_MAX_GLYPHS || header.textureCount > CB_FONT_CACHE_MAX_TEXTURES ||
+        fstat(fileno(file), &st) != 0 || (size_t) st.st_size != sizeof(header) +
+        (size_t) header.glyphCount * sizeof(struct cbFontCacheGlyph) + (size_t) header.textureCount * pageSize) {
+        fclose(file);
+        return false;
+    }
+
+    struct cbFontCacheGlyph *cached = malloc(sizeof(struct cbFontCacheGlyph) * ((size_t) header.glyphCount + 1));
+    bool ok = fread(cached, sizeof(struct cbFontCacheGlyph), header.glyphCount, file) == header.glyphCount;
+
+    for (uint32_t i = 0; ok && i < header.textureCount; i++) {
+        struct cbFontTexture* texture = createFontTexture(font);
+        ok = fread(texture->pixels, pageSize, 1, file) == 1;
+    }
+    fclose(file);
+
+    // replay packing to restore packer state, packing is deterministic
+    for (uint32_t i = 0; ok && i < header.glyphCount; i++) {
+        if (cached[i].texture >= header.textureCount) {
+            ok = false;
+            break;
+        }
+
+        struct cbFontTexture* texture = &font->textures[cached[i].texture];
+        stbrp_rect rect;
+        rect.w = cached[i].x1 - cached[i].x0;
+        rect.h = cached[i].y1 - cached[i].y0;
+        stbrp_pack_rects(texture->packer, &rect, 1);
+        if (!rect.was_packed || rect.x != cached[i].x0 || rect.y != cached[i].y0) {
+            ok = false;
+            break;
+        }
+
+        struct cbFontGlyph glyph;
+        glyph.codepoint = cached[i].codepoint;
+        glyph.texture = texture->id;
+        glyph.x0 = cached[i].x0;
+        glyph.y0 = cached[i].y0;
+        glyph.x1 = cached[i].x1;
+        glyph.y1 = cached[i].y1;
+        glyph.advance = cached[i].advance;
+        glyph.xOffset = cached[i].xOffset;
+        glyph.yOffset = cached[i].yOffset;
+        sb_push(font->glyphs, glyph);
+        indexGlyph(font);
+    }
+    free(cached);
+
+    if (!ok) {
+        clearGlyphs(font);
+        return false;
+    }
+
+    // upload whole pages
+    for (int i = 0; i < sb_count(font->textures); i++) {
+        uploadRegion(&font->textures[i], 0, 0, CB_FONT_CACHE_SIZE, CB_FONT_CACHE_SIZE);
+    }
+    return true;
+}
+
 struct quad {
     float x0, y0, x1, y1;
     float u0, v0, u1, v1;
@@ -234,51 +772,57 @@ static GLuint vbo, vao, currentTexture;
 static float *vertices = NULL; // stretchy buffer
 static mat4x4 projection;
 static const char *vertexShader = "#version 330 core                        \n"
-            "in vec4 vertex;                                                \n"
+            "layout(location = 0) in vec4 vertex;                           \n"
+            "layout(location = 1) in vec3 vertexColor;                      \n"
             "out vec2 texcoords;                                            \n"
+            "out vec3 textColor;                                            \n"
             "void main() {                                                  \n"
             "gl_Position = vec4(vertex.xy, 0.0, 1.0);                       \n"
             "texcoords = vertex.zw;                                         \n"
+            "textColor = vertexColor;                                       \n"
             "}                                                              \n";
 
 static const char *fragmentShader = "#version 330 core                      \n"
             "in vec2 texcoords;                                             \n"
+            "in vec3 textColor;                                             \n"
             "out vec4 color;                                                \n"
             "uniform sampler2D text;                                        \n"
-            "uniform vec3 textColor;                                        \n"
             "void main() {                                                  \n"
             "vec4 sampled = vec4(1.0, 1.0, 1.0, texture(text, texcoords).r);\n"
             "color = vec4(textColor.rgb, 1.0) * sampled;                    \n"
             "}                                                              \n";
 
-void cbInitFontRenderer() {
+static void initRenderer(void *arg) {
     shaderProgram = cbCreateShader(vertexShader, fragmentShader);
     glGenVertexArrays(1, &vao);
     glGenBuffers(1, &vbo);
+}
 
-    emptyData = malloc(CB_FONT_CACHE_SIZE * CB_FONT_CACHE_SIZE);
-    memset(emptyData, 0, CB_FONT_CACHE_SIZE * CB_FONT_CACHE_SIZE);
+void cbInitFontRenderer() {
+    cbRenderCall(initRenderer, NULL);
 }
 
-void cbDestroyFontRenderer() {
+static void destroyRenderer(void *arg) {
     glDeleteVertexArrays(1, &vao);
     glDeleteBuffers(1, &vbo);
     cbDeleteShader(shaderProgram);
+}
+
+void cbDestroyFontRenderer() {
+    cbRenderSubmit(destroyRenderer, NULL, 0);
 
-    free(emptyData);
     for (int i = 0; i < sb_count(fonts); i++) {
         cbDestroyFont(fonts[i].id);
     }
     sb_free(fonts);
     fonts = NULL;
+    sb_free(faces);
+    faces = NULL;
+    sb_free(pendingGlyphs);
+    pendingGlyphs = NULL;
 }
 
-void cbStartFontRenderer() {
-    // get ortho from window size
-    int viewX, viewY;
-    cbGetSize(&viewX, &viewY);
-    mat4x4_ortho(projection, 0.0f, (float) viewX, (float) viewY, 0.0f, -1.0f, 1.0f);
-
+static void startRenderer(void *arg) {
     // setup gl
     glDisable(GL_DEPTH_TEST);
     glEnable(GL_BLEND);
@@ -289,41 +833,90 @@ void cbStartFontRenderer() {
     glUniform1i(glGetUniformLocation(shaderProgram, "text"), 0);
 }
 
-static void flushRenderer(GLuint texture) {
-    if (sb_count(vertices) == 0)
-        return;
+void cbStartFontRenderer() {
+    // get ortho from window size
+    int viewX, viewY;
+    cbGetSize(&viewX, &viewY);
+    mat4x4_ortho(projection, 0.0f, (float) viewX, (float) viewY, 0.0f, -1.0f, 1.0f);
+
+    cbRenderSubmit(startRenderer, NULL, 0);
+}
+
+// recorded batch, vertices are owned by command
+struct drawCommand {
+    GLuint texture;
+    float *vertices; // stretchy buffer
+};
+
+static void drawVertices(void *arg) {
+    struct drawCommand *draw = arg;
+    cbProfileGpuBegin("font");
 
     // bind vertices
     glBindVertexArray(vao);
     glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, sb_count(vertices) * sizeof(GLfloat), vertices, GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, sb_count(draw->vertices) * sizeof(GLfloat), draw->vertices, GL_STATIC_DRAW);
 
     // bind texture
     glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, texture);
+    glBindTexture(GL_TEXTURE_2D, draw->texture);
 
-    // draw sprite
+    // draw text, vertex is position, uv and color
     glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), 0);
-    glDrawArrays(GL_TRIANGLES, 0, sb_count(vertices) / 4);
+    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 7 * sizeof(GLfloat), 0);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 7 * sizeof(GLfloat), (void*) (4 * sizeof(GLfloat)));
+    glDrawArrays(GL_TRIANGLES, 0, sb_count(draw->vertices) / 7);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindVertexArray(0);
+    cbProfileGpuEnd();
 
     // clear vertices
-    sb_free(vertices);
-    vertices = NULL;
+    sb_free(draw->vertices);
 }
 
-void cbRenderText(cbFont id, const char *text, float x, float y, vec3 color) {
-    glUniform3fv(glGetUniformLocation(shaderProgram, "textColor"), 1, color);
+static void flushRenderer(GLuint texture) {
+    if (sb_count(vertices) == 0)
+        return;
 
-    struct cbFontImpl* font = &fonts[id];
+    cbProfileBegin("font flush");
+
+    // glyphs missed while batching
+    updateGlyphs();
+
+    // count batch
+    cbRenderStats *stats = cbRenderStatsCurrent();
+    stats->drawCalls++;
+    stats->vertices += sb_count(vertices) / 7;
+    stats->bytesUploaded += sb_count(vertices) * sizeof(GLfloat);
+    stats->textureBinds++;
+
+    // vertices go to command
+    struct drawCommand draw;
+    draw.texture = texture;
+    draw.vertices = vertices;
+    cbRenderSubmit(drawVertices, &draw, sizeof(draw));
+    vertices = NULL;
+    cbProfileEnd();
+}
+
+static void pushVertex(float x, float y, float u, float v, vec3 color) {
+    float *vertex = sb_add(vertices, 7);
+    vertex[0] = x;
+    vertex[1] = y;
+    vertex[2] = u;
+    vertex[3] = v;
+    vertex[4] = color[0];
+    vertex[5] = color[1];
+    vertex[6] = color[2];
+}
 
+// text is batched between calls until texture changes or renderer stops
+static void renderText(struct cbFontImpl* font, const char *text, const char *end, float x, float y, vec3 color) {
     uint32_t state = 0, codepoint;
     struct quad quad;
-    currentTexture = 0;
 
-    while (*text) {
+    while (text < end) {
         if (decode(&state, &codepoint, *(uint8_t*) text++)) {
             continue; // not unicode char yet
         }
@@ -335,6 +928,9 @@ void cbRenderText(cbFont id, const char *text, float x, float y, vec3 color) {
 
         // batching
         if (currentTexture != glyph->texture) {
+            if (sb_count(vertices) > 0) {
+                cbRenderStatsCurrent()->textureFlushes++;
+            }
             flushRenderer(currentTexture);
         }
         currentTexture = glyph->texture;
@@ -345,15 +941,146 @@ void cbRenderText(cbFont id, const char *text, float x, float y, vec3 color) {
         // multiply by projection
         mat4x4_mul_vec4(q0, projection, (vec4) {quad.x0, quad.y0, 0.0, 1.0});
         mat4x4_mul_vec4(q1, projection, (vec4) {quad.x1, quad.y1, 0.0, 1.0});
-        sb_push(vertices, q0[0]); sb_push(vertices, q0[1]); sb_push(vertices, quad.u0); sb_push(vertices, quad.v0);
-        sb_push(vertices, q1[0]); sb_push(vertices, q0[1]); sb_push(vertices, quad.u1); sb_push(vertices, quad.v0);
-        sb_push(vertices, q0[0]); sb_push(vertices, q1[1]); sb_push(vertices, quad.u0); sb_push(vertices, quad.v1);
-        sb_push(vertices, q1[0]); sb_push(vertices, q1[1]); sb_push(vertices, quad.u1); sb_push(vertices, quad.v1);
-        sb_push(vertices, q1[0]); sb_push(vertices, q0[1]); sb_push(vertices, quad.u1); sb_push(vertices, quad.v0);
-        sb_push(vertices, q0[0]); sb_push(vertices, q1[1]); sb_push(vertices, quad.u0); sb_push(vertices, quad.v1);
+        pushVertex(q0[0], q0[1], quad.u0, quad.v0, color);
+        pushVertex(q1[0], q0[1], quad.u1, quad.v0, color);
+        pushVertex(q0[0], q1[1], quad.u0, quad.v1, color);
+        pushVertex(q1[0], q1[1], quad.u1, quad.v1, color);
+        pushVertex(q1[0], q0[1], quad.u1, quad.v0, color);
+        pushVertex(q0[0], q1[1], quad.u0, quad.v1, color);
     }
+}
 
-    flushRenderer(currentTexture);
+void cbRenderText(cbFont id, const char *text, float x, float y, vec3 color) {
+    renderText(&fonts[id], text, text + strlen(text), x, y, color);
+}
+
+static void pushLine(cbTextLayout *layout, int start, int end, float width) {
+    cbTextLine line;
+    line.start = start;
+    line.length = end - start;
+    line.width = width;
+    sb_push(layout->lines, line);
+    if (width > layout->width) {
+        layout->width = width;
+    }
+}
+
+cbTextLayout* cbLayoutText(cbFont id, const char *text, float maxWidth, cbTextAlign align) {
+    struct cbFontImpl* font = &fonts[id];
+    int ascender, descender, gap;
+    stbtt_GetFontVMetrics(&font->stbFont, &ascender, &descender, &gap);
+
+    cbTextLayout *layout = malloc(sizeof(cbTextLayout));
+    layout->font = id;
+    layout->text = strdup(text);
+    layout->maxWidth = maxWidth;
+    layout->align = align;
+    layout->lines = NULL;
+    layout->width = 0.0f;
+    layout->lineHeight = (float) cbFontHeight(id);
+    layout->ascent = stbtt_ScaleForPixelHeight(&font->stbFont, font->size) * ascender;
+
+    uint32_t state = 0, codepoint;
+    int lineStart = 0, charStart = 0;
+    int breakAt = -1; // last space in line
+    float x = 0.0f, breakWidth = 0.0f, breakX = 0.0f;
+
+    for (int i = 0; text[i]; i++) {
+        if (state == UTF8_ACCEPT) {
+            charStart = i;
+        }
+        if (decode(&state, &codepoint, (uint8_t) text[i])) {
+            continue; // not unicode char yet
+        }
+
+        // explicit line break
+        if (codepoint == '\n') {
+            pushLine(layout, lineStart, charStart, x);
+            lineStart = i + 1;
+            breakAt = -1;
+            x = 0.0f;
+            continue;
+        }
+
+        struct cbFontGlyph* glyph = loadGlyph(font, codepoint);
+        float advance = glyph ? glyph->advance : 0.0f;
+
+        // wrap at last space, or at this char if word does not fit
+        if (maxWidth > 0.0f && x + advance > maxWidth && charStart > lineStart) {
+            if (codepoint == ' ') {
+                // overflowing space is dropped
+                pushLine(layout, lineStart, charStart, x);
+                lineStart = i + 1;
+                breakAt = -1;
+                x = 0.0f;
+                continue;
+            }
+            if (breakAt != -1) {
+                pushLine(layout, lineStart, breakAt, breakWidth);
+                lineStart = breakAt + 1;
+                x -= breakX;
+            }
+            // carried word may still be too long
+            if (x + advance > maxWidth && charStart > lineStart) {
+                pushLine(layout, lineStart, charStart, x);
+                lineStart = charStart;
+                x = 0.0f;
+            }
+            breakAt = -1;
+        }
+
+        if (codepoint == ' ') {
+            breakAt = charStart;
+            breakWidth = x;
+            breakX = x + advance;
+        }
+        x += advance;
+    }
+    pushLine(layout, lineStart, (int) strlen(text), x);
+
+    layout->height = layout->lineHeight * sb_count(layout->lines);
+    return layout;
+}
+
+void cbRenderTextLayout(cbTextLayout *layout, float x, float y, vec4 clip, vec3 color) {
+    int count = sb_count(layout->lines);
+    float boxWidth = layout->maxWidth > 0.0f ? layout->maxWidth : layout->width;
+
+    // visible lines found directly, hidden lines are not visited
+    int first = 0, last = count;
+    if (clip[1] > y) {
+        first = (int) ((clip[1] - y) / layout->lineHeight);
+    }
+    if (clip[1] + clip[3] < y + layout->height) {
+        last = (int) ceilf((clip[1] + clip[3] - y) / layout->lineHeight);
+    }
+    if (last > count) last = count;
+
+    for (int i = first; i < last; i++) {
+        cbTextLine *line = &layout->lines[i];
+
+        float offset = 0.0f;
+        if (layout->align == CB_ALIGN_CENTER) {
+            offset = floorf((boxWidth - line->width) * 0.5f);
+        } else if (layout->align == CB_ALIGN_RIGHT) {
+            offset = boxWidth - line->width;
+        }
+
+        // skip lines outside horizontally
+        float lineX = x + offset;
+        if (lineX > clip[0] + clip[2] || lineX + line->width < clip[0]) {
+            continue;
+        }
+
+        const char *start = layout->text + line->start;
+        renderText(&fonts[layout->font], start, start + line->length, lineX, y + layout->ascent + i * layout->lineHeight, color);
+    }
+}
+
+void cbDestroyTextLayout(cbTextLayout *layout) {
+    free(layout->text);
+    sb_free(layout->lines);
+    free(layout);
 }
 
 int cbTextWidth(cbFont id, const char *text) {
@@ -383,7 +1110,13 @@ int cbFontHeight(cbFont id) {
     return font->size + gap; // font size calculated with stbtt_ScaleForPixelHeight
 }
 
-void cbStopFontRenderer() {
+static void stopRenderer(void *arg) {
     glUseProgram(0);
 }
 
+void cbStopFontRenderer() {
+    flushRenderer(currentTexture);
+    currentTexture = 0;
+    cbRenderSubmit(stopRenderer, NULL, 0);
+}
+
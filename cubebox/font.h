@@ -3,13 +3,22 @@
 
 #include "linmath.h"
 
+#include <stdbool.h>
+
 #ifndef CB_FONT_CACHE_SIZE
     #define CB_FONT_CACHE_SIZE 512
 #endif
 
+// threads used to rasterize glyphs missed in one batch, job workers are used instead when running
+#ifndef CB_FONT_RASTER_THREADS
+    #define CB_FONT_RASTER_THREADS 1
+#endif
+
 typedef int cbFont; // font descriptor
 
 // load/destroy fonts
+// same font file loaded with different sizes is mapped once
+// returns -1 if file can not be read
 cbFont cbLoadFont(const char *path, int size);
 void cbDestroyFont(cbFont id);
 
@@ -23,8 +32,50 @@ void cbStopFontRenderer();
 
 // renders text with font id in x,y with color
 // align is left | baseline
+// text of all calls is batched and drawn on texture change or cbStopFontRenderer
 void cbRenderText(cbFont id, const char *text, float x, float y, vec3 color);
 
+typedef enum {
+    CB_ALIGN_LEFT = 0,
+    CB_ALIGN_CENTER,
+    CB_ALIGN_RIGHT
+} cbTextAlign;
+
+typedef struct {
+    int start, length; // bytes in layout text
+    float width;
+} cbTextLine;
+
+// wrapped text, keep it while text does not change
+// do not forget to delete it
+typedef struct {
+    cbFont font;
+    char *text; // copy of text
+    float maxWidth; // 0 - no wrapping
+    cbTextAlign align;
+    cbTextLine *lines; // stretchy buffer
+    float width, height; // bounding box
+    float lineHeight, ascent;
+} cbTextLayout;
+
+// wraps text to maxWidth at spaces and line breaks
+cbTextLayout* cbLayoutText(cbFont id, const char *text, float maxWidth, cbTextAlign align);
+
+// renders layout with top left corner in x,y
+// lines outside of clip rectangle (x, y, w, h) are skipped
+void cbRenderTextLayout(cbTextLayout *layout, float x, float y, vec4 clip, vec3 color);
+
+void cbDestroyTextLayout(cbTextLayout *layout);
+
+// rasterize glyphs ahead of rendering
+void cbFontPrewarm(cbFont id, const unsigned int *codepoints, int count);
+bool cbFontPrewarmFile(cbFont id, const char *path); // utf-8 text file with charset
+
+// save/load rasterized glyphs and atlas pages
+// cache is loaded only to font without glyphs, and only if font file and size match
+bool cbSaveFontCache(cbFont id, const char *path);
+bool cbLoadFontCache(cbFont id, const char *path);
+
 int cbTextWidth(cbFont id, const char *text);
 int cbFontHeight(cbFont id); // ascender - descender + lineGap
 
@@ -0,0 +1,320 @@
+#include "job.h"
+#include "stretchy_buffer.h"
+#include "tinycthread.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define CB_JOB_MASK (CB_JOB_QUEUE_SIZE - 1)
+
+struct cbJob {
+    cbJobFunc func;
+    void *data;
+    cbJobCounter *counter;
+};
+
+// chase-lev deque, owner pushes and pops bottom, thieves take top
+struct cbJobDeque {
+    _Alignas(64) atomic_long top;
+    _Alignas(64) atomic_long bottom;
+    _Alignas(64) struct cbJob jobs[CB_JOB_QUEUE_SIZE];
+};
+
+static struct cbJobDeque *deques = NULL; // one per worker
+static thrd_t *threads = NULL;
+static int threadCount = 1;
+static bool initialized = false;
+static _Thread_local int workerIndex = -1; // -1 - not worker thread
+
+// jobs from threads without deque
+static struct cbJob *injected = NULL; // stretchy buffer
+static atomic_int injectedCount = 0; // checked without lock
+static mtx_t injectMutex;
+
+// sleeping workers
+static atomic_bool workersRunning = false;
+static atomic_int queuedJobs = 0; // pushed, not taken yet
+static atomic_int sleepingWorkers = 0;
+static mtx_t sleepMutex;
+static cnd_t sleepCond;
+
+static bool pushJob(struct cbJobDeque *deque, const struct cbJob *job) {
+    long b = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    long t = atomic_load_explicit(&deque->top, memory_order_acquire);
+    if (b - t >= CB_JOB_QUEUE_SIZE) {
+        return false; // full
+    }
+    deque->jobs[b & CB_JOB_MASK] = *job;
+    atomic_store_explicit(&deque->bottom, b + 1, memory_order_release); // publishes slot to thieves
+    return true;
+}
+
+static bool popJob(struct cbJobDeque *deque, struct cbJob *job) {
+    long b = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&deque->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long t = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+    if (t > b) {
+        // empty
+        atomic_store_explicit(&deque->bottom, b + 1, memory_order_relaxed);
+        return false;
+    }
+
+    *job = deque->jobs[b & CB_JOB_MASK];
+    if (t == b) {
+        // last job, race with thieves
+        bool won = atomic_compare_exchange_strong_explicit(&deque->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed);
+        atomic_store_explicit(&deque->bottom, b + 1, memory_order_relaxed);
+        return won;
+    }
+    return true;
+}
+
+static bool stealJob(struct cbJobDeque *deque, struct cbJob *job) {
+    long t = atomic_load_explicit(&deque->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long b = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+    if (t >= b) {
+        return false;
+    }
+
+    // slot may be reused after top moves, copy is dropped if we lose
+    struct cbJob stolen = deque->jobs[t & CB_JOB_MASK];
+    if (!atomic_compare_exchange_strong_explicit(&deque->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed)) {
+        return false;
+    }
+    *job = stolen;
+    return true;
+}
+
+static void runJob(struct cbJob *job) {
+    job->func(job->data);
+    if (job->counter != NULL) {
+        atomic_fetch_sub_explicit(&job->counter->value, 1, memory_order_release);
+    }
+}
+
+static void wakeWorker() {
+    if (atomic_load(&sleepingWorkers) > 0) {
+        mtx_lock(&sleepMutex);
+        cnd_signal(&sleepCond);
+        mtx_unlock(&sleepMutex);
+    }
+}
+
+// own deque first, then injected jobs, then steal from others
+static bool findJob(struct cbJob *job) {
+    if (workerIndex >= 0 && popJob(&deques[workerIndex], job)) {
+        atomic_fetch_sub(&queuedJobs, 1);
+        return true;
+    }
+
+    if (atomic_load(&injectedCount) > 0) {
+        bool found = false;
+        mtx_lock(&injectMutex);
+        if (sb_count(injected) > 0) {
+            *job = sb_last(injected);
+            stb__sbn(injected)--;
+            atomic_fetch_sub(&injectedCount, 1);
+            found = true;
+        }
+        mtx_unlock(&injectMutex);
+        if (found) {
+            atomic_fetch_sub(&queuedJobs, 1);
+            return true;
+        }
+    }
+
+    // start from neighbour, spreads thieves between victims
+    int start = workerIndex >= 0 ? workerIndex + 1 : 0;
+    for (int i = 0; i < threadCount; i++) {
+        int victim = (start + i) % threadCount;
+        if (victim == workerIndex) continue;
+        if (stealJob(&deques[victim], job)) {
+            atomic_fetch_sub(&queuedJobs, 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+static int workerFunc(void *arg) {
+    workerIndex = (int) (long) arg;
+
+    int spins = 0;
+    struct cbJob job;
+    while (atomic_load(&workersRunning)) {
+        if (findJob(&job)) {
+            runJob(&job);
+            spins = 0;
+            continue;
+        }
+
+        if (++spins < CB_JOB_SPIN) {
+            thrd_yield();
+            continue;
+        }
+
+        // nothing to do, sleep until job is queued
+        mtx_lock(&sleepMutex);
+        atomic_fetch_add(&sleepingWorkers, 1);
+        while (atomic_load(&queuedJobs) == 0 && atomic_load(&workersRunning)) {
+            cnd_wait(&sleepCond, &sleepMutex);
+        }
+        atomic_fetch_sub(&sleepingWorkers, 1);
+        mtx_unlock(&sleepMutex);
+        spins = 0;
+    }
+    return 0;
+}
+
+bool cbInitJobs(int count) {
+    if (initialized) return true;
+
+    if (count <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        count = cpus > 0 ? (int) cpus : 1;
+    }
+
+    deques = aligned_alloc(64, sizeof(struct cbJobDeque) * count);
+    if (deques == NULL) {
+        printf("job deques can not be allocated\n");
+        return false;
+    }
+    for (int i = 0; i < count; i++) {
+        atomic_init(&deques[i].top, 0);
+        atomic_init(&deques[i].bottom, 0);
+    }
+    mtx_init(&injectMutex, mtx_plain);
+    mtx_init(&sleepMutex, mtx_plain);
+    cnd_init(&sleepCond);
+
+    // calling thread is worker 0
+    workerIndex = 0;
+    threadCount = count;
+    initialized = true;
+    atomic_store(&workersRunning, true);
+    threads = malloc(sizeof(thrd_t) * count);
+    for (int i = 1; i < count; i++) {
+        if (thrd_create(&threads[i], workerFunc, (void*) (long) i) != thrd_success) {
+            printf("job worker %d can not be started\n", i);
+            threadCount = i; // run with started ones
+            break;
+        }
+    }
+    return true;
+}
+
+void cbDestroyJobs() {
+    if (!initialized) return;
+
+    mtx_lock(&sleepMutex);
+    atomic_store(&workersRunning, false);
+    cnd_broadcast(&sleepCond);
+    mtx_unlock(&sleepMutex);
+    for (int i = 1; i < threadCount; i++) {
+        thrd_join(threads[i], NULL);
+    }
+
+    free(threads);
+    free(deques);
+    sb_free(injected);
+    threads = NULL;
+    deques = NULL;
+    injected = NULL;
+    mtx_destroy(&injectMutex);
+    mtx_destroy(&sleepMutex);
+    cnd_destroy(&sleepCond);
+
+    atomic_store(&queuedJobs, 0);
+    atomic_store(&injectedCount, 0);
+    threadCount = 1;
+    workerIndex = -1;
+    initialized = false;
+}
+
+int cbJobThreadCount() {
+    return threadCount;
+}
+
+void cbJobRun(cbJobFunc func, void *data, cbJobCounter *counter) {
+    struct cbJob job;
+    job.func = func;
+    job.data = data;
+    job.counter = counter;
+    if (counter != NULL) {
+        atomic_fetch_add_explicit(&counter->value, 1, memory_order_relaxed);
+    }
+
+    if (!initialized) {
+        runJob(&job);
+        return;
+    }
+
+    // counted before push, thief may take it right away
+    atomic_fetch_add(&queuedJobs, 1);
+    if (workerIndex >= 0) {
+        if (!pushJob(&deques[workerIndex], &job)) {
+            atomic_fetch_sub(&queuedJobs, 1);
+            runJob(&job); // deque is full
+            return;
+        }
+    } else {
+        mtx_lock(&injectMutex);
+        sb_push(injected, job);
+        atomic_fetch_add(&injectedCount, 1);
+        mtx_unlock(&injectMutex);
+    }
+    wakeWorker();
+}
+
+bool cbJobIsDone(cbJobCounter *counter) {
+    return atomic_load_explicit(&counter->value, memory_order_acquire) == 0;
+}
+
+void cbJobWait(cbJobCounter *counter) {
+    struct cbJob job;
+    while (!cbJobIsDone(counter)) {
+        if (initialized && findJob(&job)) {
+            runJob(&job);
+        } else {
+            thrd_yield();
+        }
+    }
+}
+
+struct parallelRange {
+    void (*func)(void *data, int start, int end);
+    void *data;
+    int start, end;
+};
+
+static void runRange(void *data) {
+    struct parallelRange *range = data;
+    range->func(range->data, range->start, range->end);
+}
+
+void cbJobParallelFor(void (*func)(void *data, int start, int end), void *data, int count, int batch) {
+    if (count <= 0) return;
+    if (batch <= 0) batch = 1;
+
+    int rangeCount = (count + batch - 1) / batch;
+    if (rangeCount == 1 || threadCount == 1) {
+        func(data, 0, count);
+        return;
+    }
+
+    struct parallelRange *ranges = malloc(sizeof(struct parallelRange) * rangeCount);
+    cbJobCounter counter = {0};
+    for (int i = 0; i < rangeCount; i++) {
+        ranges[i].func = func;
+        ranges[i].data = data;
+        ranges[i].start = i * batch;
+        ranges[i].end = (i + 1) * batch < count ? (i + 1) * batch : count;
+        cbJobRun(runRange, &ranges[i], &counter);
+    }
+    cbJobWait(&counter);
+    free(ranges);
+}
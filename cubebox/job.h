@@ -0,0 +1,51 @@
+// job system
+// every worker has own deque, idle workers steal jobs from others
+// thread calling cbInitJobs is worker 0, it runs jobs while waiting counters
+#ifndef CB_JOB_H
+#define CB_JOB_H
+
+#include <stdbool.h>
+#include <stdatomic.h>
+
+// jobs in one worker deque, must be power of two
+// jobs pushed to full deque are run immediately
+#ifndef CB_JOB_QUEUE_SIZE
+    #define CB_JOB_QUEUE_SIZE 4096
+#endif
+
+// failed attempts to find job before worker sleeps
+#ifndef CB_JOB_SPIN
+    #define CB_JOB_SPIN 64
+#endif
+
+typedef void (*cbJobFunc)(void *data);
+
+// counts unfinished jobs, zero initialize it
+// jobs depending on other jobs wait their counter, waiting runs other jobs
+typedef struct {
+    atomic_int value;
+} cbJobCounter;
+
+// threads - total workers including calling thread, 0 - one per cpu
+bool cbInitJobs(int threads);
+
+// waits running jobs and stops workers, queued jobs are dropped
+void cbDestroyJobs();
+
+// workers count, 1 if job system is not running
+int cbJobThreadCount();
+
+// queues func with data, counter is incremented and decremented when job is done
+// counter may be NULL, without job system func is called immediately
+// may be called from any thread, also from jobs
+void cbJobRun(cbJobFunc func, void *data, cbJobCounter *counter);
+
+bool cbJobIsDone(cbJobCounter *counter);
+
+// runs queued jobs until counter is zero
+void cbJobWait(cbJobCounter *counter);
+
+// calls func for [start, end) ranges of batch size covering count and waits them
+void cbJobParallelFor(void (*func)(void *data, int start, int end), void *data, int count, int batch);
+
+#endif
@@ -1,21 +1,49 @@
+#define _GNU_SOURCE // sendmmsg, recvmmsg
 #include "net.h"
+#include "utils.h"
+#include "stretchy_buffer.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 
 #include <netdb.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <arpa/inet.h>
+#include <netinet/tcp.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <poll.h>
+#include <ctype.h>
+
+#include "tinycthread.h"
+
+// simulated sockets, see SIMULATOR
+static bool isSimulated(cbSocket s);
+static void simulateSend(cbSocket s, const cbAddress* to, const char* buf, int len);
+static void flushSimulator(cbSocket s);
+static struct cbNetSimulator** simulators = NULL; // stretchy buffer, indexed by socket
+static void stopSimulator();
+
+// see PACKETS
+static void freePacketPool();
+
+// see RESOLVER
+static void stopResolver();
 
 void cbInitNet() {
     
 }
 
 void cbDestroyNet() {
-
+    stopSimulator();
+    freePacketPool();
+    stopResolver();
 }
 
 cbSocket cbOpenSocket() {
@@ -32,6 +60,11 @@ void cbSocketSetBlock(cbSocket s, bool block) {
 	}
 }
 
+void cbSocketSetNoDelay(cbSocket s, bool enable) {
+    int value = enable ? 1 : 0;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &value, sizeof(int));
+}
+
 int cbSocketSelect(cbSocket s) {
     fd_set set;
     FD_ZERO(&set);
@@ -93,9 +126,18 @@ int cbSocketListen(cbSocket s, int port) {
 	if (bind(s, (struct sockaddr*) &address, sizeof(address)) != 0) {
 		return false;
 	}
-	if (listen(s, 0) != 0) {
+	if (listen(s, SOMAXCONN) != 0) { // many clients may connect at once
 		return false;
 	}
+	return true;
+}
+
+bool cbSocketListenShared(cbSocket s, int port) {
+    int yes = 1;
+    if (setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(int)) != 0) {
+        return false;
+    }
+    return cbSocketListen(s, port);
 }
 
 int cbSocketRead(cbSocket s, char* buf, int len) {
@@ -114,5 +156,1110 @@ cbSocket cbSocketAccept(cbSocket s) {
 }
 
 void cbCloseSocket(cbSocket s) {
+    if (isSimulated(s)) {
+        cbSocketSetConditions(s, NULL);
+    }
     close(s);
 }
+
+bool cbSocketWouldBlock() {
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+/// UDP
+
+static void toSockaddr(struct sockaddr_in* out, const cbAddress* address) {
+    memset(out, 0, sizeof(*out));
+    out->sin_family = AF_INET;
+    out->sin_addr.s_addr = htonl(address->ip);
+    out->sin_port = htons(address->port);
+}
+
+static void fromSockaddr(cbAddress* out, const struct sockaddr_in* address) {
+    out->ip = ntohl(address->sin_addr.s_addr);
+    out->port = ntohs(address->sin_port);
+}
+
+bool cbMakeAddress(cbAddress* address, const char* ip, int port) {
+    struct in_addr parsed;
+    if (inet_aton(ip, &parsed) != 1) {
+        return false;
+    }
+    address->ip = ntohl(parsed.s_addr);
+    address->port = port;
+    return true;
+}
+
+bool cbAddressEqual(const cbAddress* a, const cbAddress* b) {
+    return a->ip == b->ip && a->port == b->port;
+}
+
+cbSocket cbOpenUdpSocket() {
+    return socket(AF_INET, SOCK_DGRAM, 0);
+}
+
+bool cbSocketBind(cbSocket s, int port) {
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = INADDR_ANY;
+    address.sin_port = htons(port);
+    return bind(s, (struct sockaddr*) &address, sizeof(address)) == 0;
+}
+
+bool cbSocketGetAddress(cbSocket s, cbAddress* address) {
+    struct sockaddr_in local;
+    socklen_t len = sizeof(local);
+    if (getsockname(s, (struct sockaddr*) &local, &len) != 0) {
+        return false;
+    }
+    fromSockaddr(address, &local);
+    return true;
+}
+
+bool cbSocketSetBuffers(cbSocket s, int sendSize, int receiveSize) {
+    if (sendSize > 0 && setsockopt(s, SOL_SOCKET, SO_SNDBUF, &sendSize, sizeof(int)) != 0) {
+        return false;
+    }
+    if (receiveSize > 0 && setsockopt(s, SOL_SOCKET, SO_RCVBUF, &receiveSize, sizeof(int)) != 0) {
+        return false;
+    }
+    return true;
+}
+
+int cbSocketSendTo(cbSocket s, const cbAddress* to, const char* buf, int len) {
+    if (isSimulated(s)) {
+        simulateSend(s, to, buf, len);
+        return len;
+    }
+
+    struct sockaddr_in address;
+    toSockaddr(&address, to);
+    return sendto(s, buf, len, MSG_NOSIGNAL, (struct sockaddr*) &address, sizeof(address));
+}
+
+int cbSocketReceiveFrom(cbSocket s, cbAddress* from, char* buf, int len) {
+    if (isSimulated(s)) {
+        flushSimulator(s);
+    }
+
+    struct sockaddr_in address;
+    socklen_t addressLen = sizeof(address);
+    int received = recvfrom(s, buf, len, 0, (struct sockaddr*) &address, &addressLen);
+    if (received >= 0 && from != NULL) {
+        fromSockaddr(from, &address);
+    }
+    return received;
+}
+
+int cbSocketSendBatch(cbSocket s, cbDatagram* datagrams, int count) {
+    struct mmsghdr messages[CB_NET_BATCH];
+    struct iovec vectors[CB_NET_BATCH];
+    struct sockaddr_in addresses[CB_NET_BATCH];
+
+    if (isSimulated(s)) {
+        for (int i = 0; i < count; i++) {
+            simulateSend(s, &datagrams[i].address, datagrams[i].data, datagrams[i].length);
+        }
+        return count;
+    }
+
+    int sent = 0;
+    while (sent < count) {
+        int batch = count - sent < CB_NET_BATCH ? count - sent : CB_NET_BATCH;
+        memset(messages, 0, batch * sizeof(struct mmsghdr));
+        for (int i = 0; i < batch; i++) {
+            cbDatagram* datagram = &datagrams[sent + i];
+            toSockaddr(&addresses[i], &datagram->address);
+            vectors[i].iov_base = datagram->data;
+            vectors[i].iov_len = datagram->length;
+            messages[i].msg_hdr.msg_name = &addresses[i];
+            messages[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+            messages[i].msg_hdr.msg_iov = &vectors[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        int result = sendmmsg(s, messages, batch, MSG_NOSIGNAL);
+        if (result < 0) {
+            return sent > 0 ? sent : -1;
+        }
+        sent += result;
+        if (result < batch) break; // socket buffer is full
+    }
+    return sent;
+}
+
+int cbSocketReceiveBatch(cbSocket s, cbDatagram* datagrams, int count) {
+    struct mmsghdr messages[CB_NET_BATCH];
+    struct iovec vectors[CB_NET_BATCH];
+    struct sockaddr_in addresses[CB_NET_BATCH];
+
+    if (isSimulated(s)) {
+        flushSimulator(s);
+    }
+
+    int received = 0;
+    while (received < count) {
+        int batch = count - received < CB_NET_BATCH ? count - received : CB_NET_BATCH;
+        memset(messages, 0, batch * sizeof(struct mmsghdr));
+        for (int i = 0; i < batch; i++) {
+            cbDatagram* datagram = &datagrams[received + i];
+            vectors[i].iov_base = datagram->data;
+            vectors[i].iov_len = datagram->length;
+            messages[i].msg_hdr.msg_name = &addresses[i];
+            messages[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+            messages[i].msg_hdr.msg_iov = &vectors[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        // later batches must not block, first one already got datagrams
+        int flags = received == 0 ? MSG_WAITFORONE : MSG_DONTWAIT;
+        int result = recvmmsg(s, messages, batch, flags, NULL);
+        if (result < 0) {
+            return received > 0 ? received : -1;
+        }
+        for (int i = 0; i < result; i++) {
+            cbDatagram* datagram = &datagrams[received + i];
+            fromSockaddr(&datagram->address, &addresses[i]);
+            datagram->length = messages[i].msg_len;
+        }
+        received += result;
+        if (result < batch) break; // drained
+    }
+    return received;
+}
+
+/// POLLER
+
+struct cbPoller {
+    int epoll;
+    void **data; // stretchy buffer, indexed by socket
+    struct epoll_event *events; // stretchy buffer, wait results
+};
+
+static unsigned int toEpoll(int flags) {
+    unsigned int events = EPOLLET | EPOLLRDHUP;
+    if (flags & CB_POLL_READ) events |= EPOLLIN;
+    if (flags & CB_POLL_WRITE) events |= EPOLLOUT;
+    return events;
+}
+
+cbPoller* cbCreatePoller() {
+    int epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll == -1) {
+        printf("epoll can not be created\n");
+        return NULL;
+    }
+
+    cbPoller* poller = malloc(sizeof(cbPoller));
+    poller->epoll = epoll;
+    poller->data = NULL;
+    poller->events = NULL;
+    return poller;
+}
+
+void cbDestroyPoller(cbPoller* poller) {
+    close(poller->epoll);
+    sb_free(poller->data);
+    sb_free(poller->events);
+    free(poller);
+}
+
+static bool controlPoller(cbPoller* poller, int op, cbSocket s, int flags, void* data) {
+    struct epoll_event event;
+    event.events = toEpoll(flags);
+    event.data.fd = s;
+    if (epoll_ctl(poller->epoll, op, s, &event) != 0) {
+        return false;
+    }
+
+    // data table grows to highest socket
+    if (s >= sb_count(poller->data)) {
+        int grow = s + 1 - sb_count(poller->data);
+        memset(sb_add(poller->data, grow), 0, grow * sizeof(void*));
+    }
+    poller->data[s] = data;
+    return true;
+}
+
+bool cbPollerAdd(cbPoller* poller, cbSocket s, int flags, void* data) {
+    return controlPoller(poller, EPOLL_CTL_ADD, s, flags, data);
+}
+
+bool cbPollerModify(cbPoller* poller, cbSocket s, int flags, void* data) {
+    return controlPoller(poller, EPOLL_CTL_MOD, s, flags, data);
+}
+
+void cbPollerRemove(cbPoller* poller, cbSocket s) {
+    epoll_ctl(poller->epoll, EPOLL_CTL_DEL, s, NULL);
+    if (s < sb_count(poller->data)) {
+        poller->data[s] = NULL;
+    }
+}
+
+int cbPollerWait(cbPoller* poller, cbSocketEvent* events, int max, int timeout) {
+    if (max <= 0) return 0;
+    if (sb_count(poller->events) < max) {
+        sb_add(poller->events, max - sb_count(poller->events));
+    }
+
+    int count;
+    do {
+        count = epoll_wait(poller->epoll, poller->events, max, timeout);
+    } while (count == -1 && errno == EINTR);
+
+    for (int i = 0; i < count; i++) {
+        unsigned int ready = poller->events[i].events;
+        cbSocket s = poller->events[i].data.fd;
+        events[i].socket = s;
+        events[i].data = s < sb_count(poller->data) ? poller->data[s] : NULL;
+        events[i].flags = 0;
+        if (ready & EPOLLIN) events[i].flags |= CB_POLL_READ;
+        if (ready & EPOLLOUT) events[i].flags |= CB_POLL_WRITE;
+        if (ready & (EPOLLHUP | EPOLLRDHUP)) events[i].flags |= CB_POLL_HANGUP;
+        if (ready & EPOLLERR) events[i].flags |= CB_POLL_ERROR;
+    }
+    return count;
+}
+
+/// SCATTER GATHER
+
+#define CB_NET_VECTORS 64 // on stack, more are allocated
+
+static struct iovec* toVectors(struct iovec* stackVectors, const cbBuffer* buffers, int count) {
+    struct iovec* vectors = count <= CB_NET_VECTORS ? stackVectors : malloc(count * sizeof(struct iovec));
+    for (int i = 0; i < count; i++) {
+        vectors[i].iov_base = buffers[i].data;
+        vectors[i].iov_len = buffers[i].length;
+    }
+    return vectors;
+}
+
+static int sendVectors(cbSocket s, struct sockaddr_in* address, const cbBuffer* buffers, int count) {
+    struct iovec stackVectors[CB_NET_VECTORS];
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    if (address != NULL) {
+        message.msg_name = address;
+        message.msg_namelen = sizeof(struct sockaddr_in);
+    }
+    message.msg_iov = toVectors(stackVectors, buffers, count);
+    message.msg_iovlen = count;
+
+    int result = sendmsg(s, &message, MSG_NOSIGNAL);
+    if (message.msg_iov != stackVectors) {
+        free(message.msg_iov);
+    }
+    return result;
+}
+
+int cbSocketWriteVector(cbSocket s, const cbBuffer* buffers, int count) {
+    return sendVectors(s, NULL, buffers, count);
+}
+
+int cbSocketReadVector(cbSocket s, cbBuffer* buffers, int count) {
+    struct iovec stackVectors[CB_NET_VECTORS];
+    struct iovec* vectors = toVectors(stackVectors, buffers, count);
+    int result = readv(s, vectors, count);
+    if (vectors != stackVectors) {
+        free(vectors);
+    }
+    return result;
+}
+
+int cbSocketSendToVector(cbSocket s, const cbAddress* to, const cbBuffer* buffers, int count) {
+    if (isSimulated(s)) {
+        // simulator keeps copy anyway
+        int length = 0;
+        for (int i = 0; i < count; i++) {
+            length += buffers[i].length;
+        }
+        char* joined = malloc(length > 0 ? length : 1);
+        int offset = 0;
+        for (int i = 0; i < count; i++) {
+            memcpy(joined + offset, buffers[i].data, buffers[i].length);
+            offset += buffers[i].length;
+        }
+        simulateSend(s, to, joined, length);
+        free(joined);
+        return length;
+    }
+
+    struct sockaddr_in address;
+    toSockaddr(&address, to);
+    return sendVectors(s, &address, buffers, count);
+}
+
+/// PACKETS
+
+#define CB_PACKET_CLASSES 9 // 256 << 8 = 64 kb
+
+static cbPacket** packetPool[CB_PACKET_CLASSES]; // stretchy buffers of free packets
+static atomic_flag packetPoolLock = ATOMIC_FLAG_INIT;
+
+static void lockPool() {
+    while (atomic_flag_test_and_set_explicit(&packetPoolLock, memory_order_acquire)) {
+        // short critical section, spin
+    }
+}
+
+static void unlockPool() {
+    atomic_flag_clear_explicit(&packetPoolLock, memory_order_release);
+}
+
+cbPacket* cbNewPacket(int capacity) {
+    int sizeClass = 0;
+    while (sizeClass < CB_PACKET_CLASSES && (256 << sizeClass) < capacity) {
+        sizeClass++;
+    }
+
+    cbPacket* packet = NULL;
+    if (sizeClass < CB_PACKET_CLASSES) {
+        capacity = 256 << sizeClass;
+        lockPool();
+        if (sb_count(packetPool[sizeClass]) > 0) {
+            packet = sb_last(packetPool[sizeClass]);
+            stb__sbn(packetPool[sizeClass])--;
+        }
+        unlockPool();
+    } else {
+        sizeClass = -1; // too big for pool
+    }
+
+    if (packet == NULL) {
+        // data follows header
+        packet = malloc(sizeof(cbPacket) + capacity);
+        packet->data = (char*) (packet + 1);
+        packet->capacity = capacity;
+        packet->sizeClass = sizeClass;
+    }
+    packet->length = 0;
+    atomic_init(&packet->refs, 1);
+    return packet;
+}
+
+void cbPacketRetain(cbPacket* packet) {
+    atomic_fetch_add_explicit(&packet->refs, 1, memory_order_relaxed);
+}
+
+void cbPacketRelease(cbPacket* packet) {
+    if (atomic_fetch_sub_explicit(&packet->refs, 1, memory_order_acq_rel) != 1) {
+        return;
+    }
+
+    if (packet->sizeClass >= 0) {
+        lockPool();
+        if (sb_count(packetPool[packet->sizeClass]) < CB_PACKET_POOL_SIZE) {
+            sb_push(packetPool[packet->sizeClass], packet);
+            packet = NULL;
+        }
+        unlockPool();
+    }
+    free(packet);
+}
+
+static void freePacketPool() {
+    lockPool();
+    for (int i = 0; i < CB_PACKET_CLASSES; i++) {
+        for (int j = 0; j < sb_count(packetPool[i]); j++) {
+            free(packetPool[i][j]);
+        }
+        sb_free(packetPool[i]);
+        packetPool[i] = NULL;
+    }
+    unlockPool();
+}
+
+/// CONNECTION
+
+#define CB_CONNECTION_MASK (CB_CONNECTION_BUFFER - 1)
+#define CB_FRAME_HEADER 4
+
+// head and tail only grow, masked on access
+struct cbRing {
+    char* data;
+    unsigned int head; // read position
+    unsigned int tail; // write position
+};
+
+struct cbConnection {
+    cbSocket socket;
+    struct cbRing input;
+    struct cbRing output;
+    unsigned int frameEnd; // input head after returned frame
+    char* scratch; // stretchy buffer, frames wrapping ring end
+};
+
+static int ringUsed(struct cbRing* ring) {
+    return (int) (ring->tail - ring->head);
+}
+
+// up to two contiguous parts of ring from position
+static int ringVectors(struct cbRing* ring, unsigned int from, int length, struct iovec* vectors) {
+    if (length == 0) return 0;
+    int start = from & CB_CONNECTION_MASK;
+    int first = CB_CONNECTION_BUFFER - start < length ? CB_CONNECTION_BUFFER - start : length;
+    vectors[0].iov_base = ring->data + start;
+    vectors[0].iov_len = first;
+    if (first == length) return 1;
+    vectors[1].iov_base = ring->data;
+    vectors[1].iov_len = length - first;
+    return 2;
+}
+
+static void ringCopyOut(struct cbRing* ring, unsigned int from, char* out, int length) {
+    struct iovec vectors[2];
+    int count = ringVectors(ring, from, length, vectors);
+    for (int i = 0; i < count; i++) {
+        memcpy(out, vectors[i].iov_base, vectors[i].iov_len);
+        out += vectors[i].iov_len;
+    }
+}
+
+static void ringCopyIn(struct cbRing* ring, const char* in, int length) {
+    struct iovec vectors[2];
+    int count = ringVectors(ring, ring->tail, length, vectors);
+    for (int i = 0; i < count; i++) {
+        memcpy(vectors[i].iov_base, in, vectors[i].iov_len);
+        in += vectors[i].iov_len;
+    }
+    ring->tail += length;
+}
+
+cbConnection* cbCreateConnection(cbSocket s) {
+    cbConnection* connection = calloc(1, sizeof(cbConnection));
+    connection->socket = s;
+    connection->input.data = malloc(CB_CONNECTION_BUFFER);
+    connection->output.data = malloc(CB_CONNECTION_BUFFER);
+    return connection;
+}
+
+void cbDestroyConnection(cbConnection* connection) {
+    free(connection->input.data);
+    free(connection->output.data);
+    sb_free(connection->scratch);
+    free(connection);
+}
+
+int cbConnectionReceive(cbConnection* connection) {
+    struct cbRing* input = &connection->input;
+    input->head = connection->frameEnd; // returned frame is not needed now
+
+    int space = CB_CONNECTION_BUFFER - ringUsed(input);
+    if (space == 0) return 0; // frames must be taken first
+
+    struct iovec vectors[2];
+    int count = ringVectors(input, input->tail, space, vectors);
+    int received = readv(connection->socket, vectors, count);
+    if (received > 0) {
+        input->tail += received;
+        return received;
+    }
+    if (received < 0 && cbSocketWouldBlock()) {
+        return 0;
+    }
+    return -1; // closed
+}
+
+int cbConnectionNextFrame(cbConnection* connection, cbFrame* frame) {
+    struct cbRing* input = &connection->input;
+    input->head = connection->frameEnd;
+
+    int available = ringUsed(input);
+    if (available < CB_FRAME_HEADER) return 0;
+
+    unsigned char header[CB_FRAME_HEADER];
+    ringCopyOut(input, input->head, (char*) header, CB_FRAME_HEADER);
+    unsigned int length = ((unsigned int) header[0] << 24) | (header[1] << 16) | (header[2] << 8) | header[3];
+    if (length > CB_CONNECTION_BUFFER - CB_FRAME_HEADER) return -1;
+    if (available < CB_FRAME_HEADER + (int) length) return 0;
+
+    unsigned int start = input->head + CB_FRAME_HEADER;
+    if ((start & CB_CONNECTION_MASK) + length <= CB_CONNECTION_BUFFER) {
+        frame->data = input->data + (start & CB_CONNECTION_MASK); // in place
+    } else {
+        // wraps around ring end
+        if (sb_count(connection->scratch) < (int) length) {
+            sb_add(connection->scratch, length - sb_count(connection->scratch));
+        }
+        ringCopyOut(input, start, connection->scratch, length);
+        frame->data = connection->scratch;
+    }
+    frame->length = length;
+
+    // consumed on next call, data stays valid until then
+    connection->frameEnd = start + length;
+    return 1;
+}
+
+bool cbConnectionSend(cbConnection* connection, const char* data, int length) {
+    struct cbRing* output = &connection->output;
+    int needed = CB_FRAME_HEADER + length;
+    if (needed > CB_CONNECTION_BUFFER) return false;
+
+    if (CB_CONNECTION_BUFFER - ringUsed(output) < needed) {
+        if (cbConnectionFlush(connection) < 0 || CB_CONNECTION_BUFFER - ringUsed(output) < needed) {
+            return false;
+        }
+    }
+
+    char header[CB_FRAME_HEADER];
+    header[0] = (char) (length >> 24);
+    header[1] = (char) (length >> 16);
+    header[2] = (char) (length >> 8);
+    header[3] = (char) length;
+    ringCopyIn(output, header, CB_FRAME_HEADER);
+    ringCopyIn(output, data, length);
+
+    // enough to fill segments, no reason to wait
+    if (ringUsed(output) >= CB_CONNECTION_FLUSH) {
+        return cbConnectionFlush(connection) >= 0;
+    }
+    return true;
+}
+
+int cbConnectionFlush(cbConnection* connection) {
+    struct cbRing* output = &connection->output;
+    int used = ringUsed(output);
+    if (used == 0) return 0;
+
+    struct iovec vectors[2];
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = vectors;
+    message.msg_iovlen = ringVectors(output, output->head, used, vectors);
+
+    int sent = sendmsg(connection->socket, &message, MSG_NOSIGNAL);
+    if (sent < 0) {
+        return cbSocketWouldBlock() ? used : -1;
+    }
+    output->head += sent;
+    return used - sent;
+}
+
+/// RESOLVER
+
+#define CB_HOST_NAME 256
+
+struct cbResolveEntry {
+    char name[CB_HOST_NAME];
+    unsigned int ip;
+    cbResolveState state;
+    bool started; // taken by resolver thread
+    long long expires;
+};
+
+struct cbHostEntry {
+    char name[CB_HOST_NAME];
+    unsigned int ip;
+};
+
+static struct cbHostEntry* hosts = NULL; // stretchy buffer
+
+// guarded by resolveMutex, entries are not removed so index is stable
+static struct cbResolveEntry* resolveCache = NULL; // stretchy buffer
+static once_flag resolveOnce = ONCE_FLAG_INIT;
+static mtx_t resolveMutex;
+static cnd_t resolveCond;
+static thrd_t resolveThread;
+static bool resolveRunning = false;
+static bool resolveStop = false;
+
+static void initResolver() {
+    mtx_init(&resolveMutex, mtx_plain);
+    cnd_init(&resolveCond);
+}
+
+static int findPendingName() {
+    for (int i = 0; i < sb_count(resolveCache); i++) {
+        if (resolveCache[i].state == CB_RESOLVE_PENDING && !resolveCache[i].started) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int resolveThreadFunc(void* arg) {
+    mtx_lock(&resolveMutex);
+    while (true) {
+        int index;
+        while ((index = findPendingName()) == -1 && !resolveStop) {
+            cnd_wait(&resolveCond, &resolveMutex);
+        }
+        if (resolveStop) break;
+
+        char name[CB_HOST_NAME];
+        strcpy(name, resolveCache[index].name);
+        resolveCache[index].started = true;
+        mtx_unlock(&resolveMutex);
+
+        // slow part without lock
+        struct addrinfo hints;
+        struct addrinfo* result = NULL;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        bool found = getaddrinfo(name, NULL, &hints, &result) == 0 && result != NULL;
+        unsigned int ip = found ? ntohl(((struct sockaddr_in*) result->ai_addr)->sin_addr.s_addr) : 0;
+        if (result != NULL) {
+            freeaddrinfo(result);
+        }
+
+        mtx_lock(&resolveMutex);
+        struct cbResolveEntry* entry = &resolveCache[index];
+        entry->ip = ip;
+        entry->state = found ? CB_RESOLVE_DONE : CB_RESOLVE_FAILED;
+        entry->started = false;
+        entry->expires = cbNanoTime() + (found ? CB_RESOLVE_CACHE_TIME : CB_RESOLVE_RETRY_TIME) * 1000000000LL;
+    }
+    mtx_unlock(&resolveMutex);
+    return 0;
+}
+
+static void stopResolver() {
+    call_once(&resolveOnce, initResolver);
+    mtx_lock(&resolveMutex);
+    bool running = resolveRunning;
+    resolveStop = true;
+    cnd_broadcast(&resolveCond);
+    mtx_unlock(&resolveMutex);
+    if (running) {
+        thrd_join(resolveThread, NULL);
+    }
+
+    sb_free(resolveCache);
+    resolveCache = NULL;
+    resolveRunning = false;
+    resolveStop = false;
+    sb_free(hosts);
+    hosts = NULL;
+}
+
+bool cbSetHostsFile(const char* path) {
+    sb_free(hosts);
+    hosts = NULL;
+    if (path == NULL) return true;
+
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        printf("hosts file %s can not be opened\n", path);
+        return false;
+    }
+
+    // ip followed by names, # starts comment
+    char line[1024];
+    while (fgets(line, sizeof(line), file) != NULL) {
+        char* comment = strchr(line, '#');
+        if (comment != NULL) *comment = '\0';
+
+        char* save = NULL;
+        char* ip = strtok_r(line, " \t\r\n", &save);
+        struct in_addr parsed;
+        if (ip == NULL || inet_aton(ip, &parsed) != 1) continue;
+
+        char* name;
+        while ((name = strtok_r(NULL, " \t\r\n", &save)) != NULL) {
+            struct cbHostEntry entry;
+            snprintf(entry.name, CB_HOST_NAME, "%s", name);
+            entry.ip = ntohl(parsed.s_addr);
+            sb_push(hosts, entry);
+        }
+    }
+    fclose(file);
+    return true;
+}
+
+cbResolveState cbResolve(const char* host, unsigned int* ip) {
+    struct in_addr parsed;
+    if (inet_aton(host, &parsed) == 1) {
+        *ip = ntohl(parsed.s_addr);
+        return CB_RESOLVE_DONE;
+    }
+    for (int i = 0; i < sb_count(hosts); i++) {
+        if (strcasecmp(hosts[i].name, host) == 0) {
+            *ip = hosts[i].ip;
+            return CB_RESOLVE_DONE;
+        }
+    }
+    if (strlen(host) >= CB_HOST_NAME) {
+        return CB_RESOLVE_FAILED;
+    }
+
+    call_once(&resolveOnce, initResolver);
+    mtx_lock(&resolveMutex);
+
+    // thread starts with first name
+    if (!resolveRunning) {
+        resolveRunning = thrd_create(&resolveThread, resolveThreadFunc, NULL) == thrd_success;
+        if (!resolveRunning) {
+            mtx_unlock(&resolveMutex);
+            printf("resolver thread can not be started\n");
+            return CB_RESOLVE_FAILED;
+        }
+    }
+
+    struct cbResolveEntry* entry = NULL;
+    for (int i = 0; i < sb_count(resolveCache); i++) {
+        if (strcasecmp(resolveCache[i].name, host) == 0) {
+            entry = &resolveCache[i];
+            break;
+        }
+    }
+    if (entry == NULL) {
+        entry = sb_add(resolveCache, 1);
+        memset(entry, 0, sizeof(*entry));
+        strcpy(entry->name, host);
+        entry->state = CB_RESOLVE_PENDING;
+        cnd_signal(&resolveCond);
+    } else if (entry->state != CB_RESOLVE_PENDING && cbNanoTime() >= entry->expires) {
+        entry->state = CB_RESOLVE_PENDING; // refresh
+        cnd_signal(&resolveCond);
+    }
+
+    cbResolveState state = entry->state;
+    *ip = entry->ip;
+    mtx_unlock(&resolveMutex);
+    return state;
+}
+
+/// CONNECTOR
+
+struct cbConnector {
+    char host[CB_HOST_NAME];
+    int port;
+    cbConnectState state;
+    cbSocket socket;
+    long long deadline;
+};
+
+cbConnector* cbStartConnect(const char* host, int port) {
+    cbConnector* connector = calloc(1, sizeof(cbConnector));
+    snprintf(connector->host, CB_HOST_NAME, "%s", host);
+    connector->port = port;
+    connector->state = CB_CONNECT_RESOLVING;
+    connector->socket = -1;
+    connector->deadline = cbNanoTime() + CB_CONNECT_TIMEOUT * 1000000LL;
+    cbConnectorUpdate(connector);
+    return connector;
+}
+
+static void failConnect(cbConnector* connector) {
+    if (connector->socket != -1) {
+        close(connector->socket);
+        connector->socket = -1;
+    }
+    connector->state = CB_CONNECT_FAILED;
+}
+
+cbConnectState cbConnectorUpdate(cbConnector* connector) {
+    if (connector->state == CB_CONNECT_DONE || connector->state == CB_CONNECT_FAILED) {
+        return connector->state;
+    }
+    if (cbNanoTime() >= connector->deadline) {
+        failConnect(connector);
+        return connector->state;
+    }
+
+    if (connector->state == CB_CONNECT_RESOLVING) {
+        unsigned int ip;
+        cbResolveState resolved = cbResolve(connector->host, &ip);
+        if (resolved == CB_RESOLVE_PENDING) return connector->state;
+        if (resolved == CB_RESOLVE_FAILED) {
+            failConnect(connector);
+            return connector->state;
+        }
+
+        connector->socket = cbOpenSocket();
+        if (connector->socket == -1) {
+            failConnect(connector);
+            return connector->state;
+        }
+        cbSocketSetBlock(connector->socket, false);
+
+        struct sockaddr_in address;
+        cbAddress peer = {ip, (unsigned short) connector->port};
+        toSockaddr(&address, &peer);
+        if (connect(connector->socket, (struct sockaddr*) &address, sizeof(address)) == 0) {
+            connector->state = CB_CONNECT_DONE;
+        } else if (errno == EINPROGRESS) {
+            connector->state = CB_CONNECT_CONNECTING;
+        } else {
+            failConnect(connector);
+        }
+        return connector->state;
+    }
+
+    // connecting, writable when done
+    struct pollfd waiting;
+    waiting.fd = connector->socket;
+    waiting.events = POLLOUT;
+    if (poll(&waiting, 1, 0) <= 0) return connector->state;
+
+    int error = 0;
+    socklen_t len = sizeof(error);
+    if (getsockopt(connector->socket, SOL_SOCKET, SO_ERROR, &error, &len) != 0 || error != 0) {
+        failConnect(connector);
+    } else {
+        connector->state = CB_CONNECT_DONE;
+    }
+    return connector->state;
+}
+
+cbSocket cbConnectorTakeSocket(cbConnector* connector) {
+    if (connector->state != CB_CONNECT_DONE) return -1;
+    cbSocket s = connector->socket;
+    connector->socket = -1;
+    return s;
+}
+
+void cbDestroyConnector(cbConnector* connector) {
+    if (connector->socket != -1) {
+        close(connector->socket);
+    }
+    free(connector);
+}
+
+/// SIMULATOR
+
+struct cbDelayedDatagram {
+    long long due; // nanoseconds
+    cbAddress address;
+    char* data;
+    int length;
+};
+
+struct cbNetSimulator {
+    cbNetConditions conditions;
+    unsigned int random; // xorshift state
+    struct cbDelayedDatagram* delayed; // stretchy buffer, sorted by due
+};
+
+// table and delayed datagrams are shared with sending and receiving threads
+// flags are read without lock so plain sockets never touch the mutex
+static atomic_bool simulatedFlags[CB_NET_MAX_SIMULATED];
+static atomic_int simulatedCount = 0;
+static once_flag simulatorOnce = ONCE_FLAG_INIT;
+static mtx_t simulatorMutex;
+static cnd_t simulatorCond; // new datagram or stop
+static thrd_t simulatorThread;
+static bool simulatorStarted = false;
+static bool simulatorStop = false;
+
+static void initSimulator() {
+    mtx_init(&simulatorMutex, mtx_plain);
+    cnd_init(&simulatorCond);
+}
+
+// under mutex
+static struct cbNetSimulator* findSimulator(cbSocket s) {
+    return s >= 0 && s < sb_count(simulators) ? simulators[s] : NULL;
+}
+
+// simulated path checks table again under mutex
+static bool isSimulated(cbSocket s) {
+    return s >= 0 && s < CB_NET_MAX_SIMULATED && atomic_load_explicit(&simulatedFlags[s], memory_order_relaxed);
+}
+
+// 0 - 1
+static float simulatorRandom(struct cbNetSimulator* simulator) {
+    unsigned int x = simulator->random;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    simulator->random = x;
+    return (float) (x >> 8) / 16777216.0f;
+}
+
+static void delayDatagram(struct cbNetSimulator* simulator, const cbAddress* to, const char* buf, int len) {
+    cbNetConditions* conditions = &simulator->conditions;
+    long long delay = conditions->latency * 1000000LL;
+    if (conditions->jitter > 0) {
+        delay += (long long) ((simulatorRandom(simulator) * 2.0f - 1.0f) * conditions->jitter * 1000000.0f);
+    }
+    if (simulatorRandom(simulator) < conditions->reorder) {
+        delay += (conditions->latency + conditions->jitter) * 1000000LL; // behind later ones
+    }
+    if (delay < 0) {
+        delay = 0;
+    }
+
+    struct cbDelayedDatagram datagram;
+    datagram.due = cbNanoTime() + delay;
+    datagram.address = *to;
+    datagram.data = malloc(len > 0 ? len : 1);
+    memcpy(datagram.data, buf, len);
+    datagram.length = len;
+
+    // keep sorted, equal due keeps send order
+    int at = sb_count(simulator->delayed);
+    sb_push(simulator->delayed, datagram);
+    while (at > 0 && simulator->delayed[at - 1].due > datagram.due) {
+        simulator->delayed[at] = simulator->delayed[at - 1];
+        at--;
+    }
+    simulator->delayed[at] = datagram;
+}
+
+// under mutex, sends due datagrams, returns due time of next one or 0
+static long long flushDue(struct cbNetSimulator* simulator, cbSocket s, long long now) {
+    int due = 0;
+    while (due < sb_count(simulator->delayed) && simulator->delayed[due].due <= now) {
+        struct cbDelayedDatagram* datagram = &simulator->delayed[due];
+        struct sockaddr_in address;
+        toSockaddr(&address, &datagram->address);
+        sendto(s, datagram->data, datagram->length, MSG_NOSIGNAL, (struct sockaddr*) &address, sizeof(address));
+        free(datagram->data);
+        due++;
+    }
+
+    int left = sb_count(simulator->delayed) - due;
+    if (due > 0) {
+        memmove(simulator->delayed, simulator->delayed + due, left * sizeof(struct cbDelayedDatagram));
+        stb__sbn(simulator->delayed) = left;
+    }
+    return left > 0 ? simulator->delayed[0].due : 0;
+}
+
+// sends datagrams when due, sockets may be blocked in receive meanwhile
+static int simulatorFunc(void* arg) {
+    mtx_lock(&simulatorMutex);
+    while (!simulatorStop) {
+        long long now = cbNanoTime();
+        long long next = 0;
+        for (int i = 0; i < sb_count(simulators); i++) {
+            if (simulators[i] != NULL) {
+                long long due = flushDue(simulators[i], i, now);
+                if (due != 0 && (next == 0 || due < next)) {
+                    next = due;
+                }
+            }
+        }
+
+        if (next == 0) {
+            cnd_wait(&simulatorCond, &simulatorMutex);
+        } else {
+            // condition waits on wall clock
+            struct timespec until;
+            timespec_get(&until, TIME_UTC);
+            long long wait = next - now;
+            until.tv_sec += wait / 1000000000LL;
+            until.tv_nsec += wait % 1000000000LL;
+            if (until.tv_nsec >= 1000000000L) {
+                until.tv_sec++;
+                until.tv_nsec -= 1000000000L;
+            }
+            cnd_timedwait(&simulatorCond, &simulatorMutex, &until);
+        }
+    }
+    mtx_unlock(&simulatorMutex);
+    return 0;
+}
+
+static void simulateSend(cbSocket s, const cbAddress* to, const char* buf, int len) {
+    mtx_lock(&simulatorMutex);
+    struct cbNetSimulator* simulator = findSimulator(s);
+    if (simulator != NULL && simulatorRandom(simulator) >= simulator->conditions.loss) {
+        delayDatagram(simulator, to, buf, len);
+        if (simulatorRandom(simulator) < simulator->conditions.duplicate) {
+            delayDatagram(simulator, to, buf, len);
+        }
+        flushDue(simulator, s, cbNanoTime());
+        cnd_signal(&simulatorCond); // may be due before one thread waits for
+    }
+    mtx_unlock(&simulatorMutex);
+}
+
+static void flushSimulator(cbSocket s) {
+    mtx_lock(&simulatorMutex);
+    struct cbNetSimulator* simulator = findSimulator(s);
+    if (simulator != NULL) {
+        flushDue(simulator, s, cbNanoTime());
+    }
+    mtx_unlock(&simulatorMutex);
+}
+
+// under mutex
+static void freeSimulator(cbSocket s) {
+    struct cbNetSimulator* simulator = simulators[s];
+    for (int i = 0; i < sb_count(simulator->delayed); i++) {
+        free(simulator->delayed[i].data);
+    }
+    sb_free(simulator->delayed);
+    free(simulator);
+    simulators[s] = NULL;
+    atomic_store_explicit(&simulatedFlags[s], false, memory_order_relaxed);
+    atomic_fetch_sub(&simulatedCount, 1);
+}
+
+void cbSocketSetConditions(cbSocket s, const cbNetConditions* conditions) {
+    if (s < 0) return;
+    if (s >= CB_NET_MAX_SIMULATED) {
+        printf("socket %d above CB_NET_MAX_SIMULATED can not be simulated\n", s);
+        return;
+    }
+    call_once(&simulatorOnce, initSimulator);
+
+    mtx_lock(&simulatorMutex);
+    if (findSimulator(s) != NULL) {
+        freeSimulator(s);
+    }
+    if (conditions != NULL) {
+        if (s >= sb_count(simulators)) {
+            int grow = s + 1 - sb_count(simulators);
+            memset(sb_add(simulators, grow), 0, grow * sizeof(struct cbNetSimulator*));
+        }
+        struct cbNetSimulator* simulator = malloc(sizeof(struct cbNetSimulator));
+        simulator->conditions = *conditions;
+        simulator->random = conditions->seed != 0 ? conditions->seed : 1; // xorshift needs non zero
+        simulator->delayed = NULL;
+        simulators[s] = simulator;
+        atomic_store_explicit(&simulatedFlags[s], true, memory_order_relaxed);
+        atomic_fetch_add(&simulatedCount, 1);
+
+        if (!simulatorStarted) {
+            simulatorStop = false;
+            simulatorStarted = thrd_create(&simulatorThread, simulatorFunc, NULL) == thrd_success;
+            if (!simulatorStarted) {
+                printf("network simulator thread can not be started\n");
+            }
+        }
+    }
+    mtx_unlock(&simulatorMutex);
+}
+
+void cbNetSimulatorUpdate() {
+    if (atomic_load_explicit(&simulatedCount, memory_order_relaxed) == 0) return;
+
+    mtx_lock(&simulatorMutex);
+    long long now = cbNanoTime();
+    for (int i = 0; i < sb_count(simulators); i++) {
+        if (simulators[i] != NULL) {
+            flushDue(simulators[i], i, now);
+        }
+    }
+    mtx_unlock(&simulatorMutex);
+}
+
+static void stopSimulator() {
+    call_once(&simulatorOnce, initSimulator);
+
+    mtx_lock(&simulatorMutex);
+    bool started = simulatorStarted;
+    simulatorStop = true;
+    simulatorStarted = false;
+    cnd_signal(&simulatorCond);
+    mtx_unlock(&simulatorMutex);
+    if (started) {
+        thrd_join(simulatorThread, NULL);
+    }
+
+    mtx_lock(&simulatorMutex);
+    for (int i = 0; i < sb_count(simulators); i++) {
+        if (simulators[i] != NULL) {
+            freeSimulator(i);
+        }
+    }
+    sb_free(simulators);
+    simulators = NULL;
+    mtx_unlock(&simulatorMutex);
+}
@@ -2,6 +2,7 @@
 #define CB_NET_H
 
 #include <stdbool.h>
+#include <stdatomic.h>
 
 typedef int cbSocket;
 
@@ -10,12 +11,243 @@ void cbDestroyNet();
 
 cbSocket cbOpenSocket();
 void cbSocketSetBlock(cbSocket s, bool block);
+// disables kernel nagle, use when writes are already coalesced
+void cbSocketSetNoDelay(cbSocket s, bool enable);
 int cbSocketSelect(cbSocket s);
 int cbSocketConnect(cbSocket s, const char* addr, int port);
 int cbSocketListen(cbSocket s, int port);
+// many sockets listen on same port, kernel spreads connections between them
+bool cbSocketListenShared(cbSocket s, int port);
 cbSocket cbSocketAccept(cbSocket s);
 int cbSocketRead(cbSocket s, char* buf, int len);
 int cbSocketWrite(cbSocket s, char* buf, int len);
 void cbCloseSocket(cbSocket s);
 
+// true if last failed read or write on non-blocking socket has to be retried later
+bool cbSocketWouldBlock();
+
+/// UDP
+
+// datagrams per sendmmsg or recvmmsg call
+#ifndef CB_NET_BATCH
+    #define CB_NET_BATCH 64
+#endif
+
+// ipv4 endpoint, host byte order
+typedef struct {
+    unsigned int ip;
+    unsigned short port;
+} cbAddress;
+
+typedef struct {
+    cbAddress address; // destination or source
+    char* data;
+    int length; // bytes to send, on receive buffer size and then bytes received
+} cbDatagram;
+
+// parses dotted ip
+bool cbMakeAddress(cbAddress* address, const char* ip, int port);
+bool cbAddressEqual(const cbAddress* a, const cbAddress* b);
+
+cbSocket cbOpenUdpSocket();
+
+// binds socket to port on all interfaces, 0 - any free port
+bool cbSocketBind(cbSocket s, int port);
+
+// local address of bound or connected socket
+bool cbSocketGetAddress(cbSocket s, cbAddress* address);
+
+// kernel buffer sizes in bytes, 0 - keep, bursts over receive buffer are dropped
+bool cbSocketSetBuffers(cbSocket s, int sendSize, int receiveSize);
+
+int cbSocketSendTo(cbSocket s, const cbAddress* to, const char* buf, int len);
+int cbSocketReceiveFrom(cbSocket s, cbAddress* from, char* buf, int len);
+
+// one syscall per CB_NET_BATCH datagrams, returns count sent or received, -1 on error
+// receive waits only for first datagram on blocking socket
+int cbSocketSendBatch(cbSocket s, cbDatagram* datagrams, int count);
+int cbSocketReceiveBatch(cbSocket s, cbDatagram* datagrams, int count);
+
+/// SCATTER GATHER
+
+// pieces of one message, sent or read with one syscall
+typedef struct {
+    char* data;
+    int length;
+} cbBuffer;
+
+int cbSocketWriteVector(cbSocket s, const cbBuffer* buffers, int count);
+int cbSocketReadVector(cbSocket s, cbBuffer* buffers, int count);
+
+// buffers are sent as one datagram
+int cbSocketSendToVector(cbSocket s, const cbAddress* to, const cbBuffer* buffers, int count);
+
+/// PACKETS
+
+// pooled reference counted buffer, serialize once and send to many sockets
+// each owner retains, last release returns it to pool, safe between threads
+typedef struct {
+    char* data;
+    int length; // bytes written
+    int capacity;
+    atomic_int refs;
+    int sizeClass; // -1 - not pooled
+} cbPacket;
+
+// free packets kept per size class, classes are 256 bytes to 64 kb
+#ifndef CB_PACKET_POOL_SIZE
+    #define CB_PACKET_POOL_SIZE 256
+#endif
+
+// packet with one reference and at least capacity bytes
+cbPacket* cbNewPacket(int capacity);
+void cbPacketRetain(cbPacket* packet);
+void cbPacketRelease(cbPacket* packet);
+
+/// CONNECTION
+
+// length prefixed messages over stream socket
+// received bytes go to ring buffer, frames are read in place
+// sent frames are queued and written together on flush
+
+// ring size of each direction, must be power of two, largest frame is 4 bytes less
+#ifndef CB_CONNECTION_BUFFER
+    #define CB_CONNECTION_BUFFER 65536
+#endif
+
+// queued bytes written without waiting for flush
+#ifndef CB_CONNECTION_FLUSH
+    #define CB_CONNECTION_FLUSH 16384
+#endif
+
+typedef struct cbConnection cbConnection;
+
+typedef struct {
+    char* data; // valid until next cbConnectionNextFrame or cbConnectionReceive
+    int length;
+} cbFrame;
+
+// socket is not closed with connection
+cbConnection* cbCreateConnection(cbSocket s);
+void cbDestroyConnection(cbConnection* connection);
+
+// reads what socket has into receive ring
+// returns bytes read, -1 if peer closed or on error, would block is 0
+int cbConnectionReceive(cbConnection* connection);
+
+// 1 - frame is returned, 0 - no whole frame yet, -1 - frame is bigger than ring
+int cbConnectionNextFrame(cbConnection* connection, cbFrame* frame);
+
+// queues frame, false if it does not fit even after flush
+bool cbConnectionSend(cbConnection* connection, const char* data, int length);
+
+// writes queued frames with one syscall, returns bytes left queued or -1 on error
+int cbConnectionFlush(cbConnection* connection);
+
+/// RESOLVER
+
+// names are resolved on background thread, results are cached
+#ifndef CB_RESOLVE_CACHE_TIME
+    #define CB_RESOLVE_CACHE_TIME 300 // seconds
+#endif
+
+#ifndef CB_RESOLVE_RETRY_TIME
+    #define CB_RESOLVE_RETRY_TIME 5 // seconds before failed name is tried again
+#endif
+
+typedef enum {
+    CB_RESOLVE_PENDING,
+    CB_RESOLVE_DONE,
+    CB_RESOLVE_FAILED
+} cbResolveState;
+
+// starts or polls resolution of host, never blocks
+// dotted ips and hosts file names are done at once
+cbResolveState cbResolve(const char* host, unsigned int* ip);
+
+// names from hosts file format are used before system resolver, NULL - none
+bool cbSetHostsFile(const char* path);
+
+/// CONNECTOR
+
+// connects without blocking, update it every frame
+#ifndef CB_CONNECT_TIMEOUT
+    #define CB_CONNECT_TIMEOUT 5000 // milliseconds, resolving included
+#endif
+
+typedef enum {
+    CB_CONNECT_RESOLVING,
+    CB_CONNECT_CONNECTING,
+    CB_CONNECT_DONE,
+    CB_CONNECT_FAILED
+} cbConnectState;
+
+typedef struct cbConnector cbConnector;
+
+cbConnector* cbStartConnect(const char* host, int port);
+cbConnectState cbConnectorUpdate(cbConnector* connector);
+
+// connected non-blocking socket, caller owns it after this
+cbSocket cbConnectorTakeSocket(cbConnector* connector);
+
+// closes socket if it was not taken
+void cbDestroyConnector(cbConnector* connector);
+
+/// SIMULATOR
+
+// sockets below this number can be simulated, others always send directly
+#ifndef CB_NET_MAX_SIMULATED
+    #define CB_NET_MAX_SIMULATED 1024
+#endif
+
+// bad network on loopback, applied to datagrams sent through socket
+// random decisions come from seed, same seed and send order give same drops
+typedef struct {
+    unsigned int seed;
+    int latency; // milliseconds
+    int jitter; // milliseconds, added or subtracted at random
+    float loss; // 0 - 1 chances
+    float duplicate;
+    float reorder; // packet is held back for extra latency
+} cbNetConditions;
+
+// NULL - send directly again, delayed datagrams are dropped
+void cbSocketSetConditions(cbSocket s, const cbNetConditions* conditions);
+
+// sends delayed datagrams that are due
+// background thread and send and receive functions of simulated socket do it too,
+// so blocking sockets work, call it to send them right now
+void cbNetSimulatorUpdate();
+
+/// POLLER
+
+// waits many sockets at once, backed by epoll
+// sockets are edge triggered, read or write until cbSocketWouldBlock after event
+typedef struct cbPoller cbPoller;
+
+typedef enum {
+    CB_POLL_READ = 1,
+    CB_POLL_WRITE = 2,
+    CB_POLL_HANGUP = 4, // peer closed, set with read
+    CB_POLL_ERROR = 8
+} cbPollFlags;
+
+typedef struct {
+    cbSocket socket;
+    int flags; // cbPollFlags
+    void *data; // passed to cbPollerAdd
+} cbSocketEvent;
+
+cbPoller* cbCreatePoller();
+void cbDestroyPoller(cbPoller* poller);
+
+// watch socket for flags, data is returned with its events
+bool cbPollerAdd(cbPoller* poller, cbSocket s, int flags, void* data);
+bool cbPollerModify(cbPoller* poller, cbSocket s, int flags, void* data);
+void cbPollerRemove(cbPoller* poller, cbSocket s); // before closing socket
+
+// fills up to max events, timeout in milliseconds, 0 - return immediately, -1 - forever
+// returns count of events, -1 on error
+int cbPollerWait(cbPoller* poller, cbSocketEvent* events, int max, int timeout);
+
 #endif
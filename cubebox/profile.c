@@ -0,0 +1,299 @@
+#include "profile.h"
+#include "glad.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define CB_PROFILE_STACK_SIZE 64
+
+// slots are found by masking index
+_Static_assert((CB_PROFILE_RING_SIZE & (CB_PROFILE_RING_SIZE - 1)) == 0, "CB_PROFILE_RING_SIZE must be power of two");
+
+struct cbProfileZone {
+    const char *name;
+    long long begin, end; // nanoseconds
+    unsigned int thread;
+    unsigned int frame;
+    atomic_uint_fast64_t sequence; // write index + 1 when complete
+};
+
+// multiple producers reserve slots with atomic increment
+static struct cbProfileZone zones[CB_PROFILE_RING_SIZE];
+static atomic_uint_fast64_t writeIndex = 0;
+static atomic_uint frameIndex = 0;
+static atomic_uint threadCount = 0;
+static atomic_bool enabled = false;
+
+// open zones of this thread
+static _Thread_local struct {
+    const char *name;
+    long long begin;
+} stack[CB_PROFILE_STACK_SIZE];
+static _Thread_local int stackSize = 0;
+static _Thread_local unsigned int threadId = 0; // 0 - not assigned
+
+void cbProfileEnable(bool enable) {
+    atomic_store(&enabled, enable);
+}
+
+bool cbProfileIsEnabled() {
+    return atomic_load_explicit(&enabled, memory_order_relaxed);
+}
+
+void cbProfileBegin(const char *name) {
+    if (!cbProfileIsEnabled()) return;
+    if (stackSize == CB_PROFILE_STACK_SIZE) {
+        stackSize++; // too deep, count it to keep end balanced
+        return;
+    }
+
+    stack[stackSize].name = name;
+    stack[stackSize].begin = cbNanoTime();
+    stackSize++;
+}
+
+static void pushZone(const char *name, long long begin, long long end, unsigned int thread, unsigned int frame) {
+    // reserve slot and publish it when written
+    uint_fast64_t index = atomic_fetch_add_explicit(&writeIndex, 1, memory_order_relaxed);
+    struct cbProfileZone *zone = &zones[index & (CB_PROFILE_RING_SIZE - 1)];
+    atomic_store_explicit(&zone->sequence, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release); // slot is invalid before fields change
+    zone->name = name;
+    zone->begin = begin;
+    zone->end = end;
+    zone->thread = thread;
+    zone->frame = frame;
+    atomic_store_explicit(&zone->sequence, index + 1, memory_order_release);
+}
+
+void cbProfileEnd() {
+    if (stackSize == 0) return; // begin was called while disabled
+    stackSize--;
+    if (stackSize >= CB_PROFILE_STACK_SIZE) return;
+
+    long long end = cbNanoTime();
+    if (threadId == 0) {
+        threadId = atomic_fetch_add(&threadCount, 1) + 1;
+    }
+    pushZone(stack[stackSize].name, stack[stackSize].begin, end, threadId, atomic_load_explicit(&frameIndex, memory_order_relaxed));
+}
+
+void cbProfileFrame() {
+    atomic_fetch_add(&frameIndex, 1);
+}
+
+unsigned int cbProfileFrameIndex() {
+    return atomic_load(&frameIndex);
+}
+
+// gpu queries of one frame, read back CB_PROFILE_GPU_FRAMES later
+struct cbProfileGpuFrame {
+    GLuint queries[CB_PROFILE_GPU_QUERIES];
+    const char *names[CB_PROFILE_GPU_QUERIES];
+    long long begins[CB_PROFILE_GPU_QUERIES]; // cpu time of issue
+    int count;
+    unsigned int frame;
+};
+
+// last resolved gpu time by pass name
+struct cbProfileGpuPass {
+    const char *name;
+    long long time;
+    unsigned int frame;
+};
+
+static struct cbProfileGpuFrame gpuFrames[CB_PROFILE_GPU_FRAMES];
+static struct cbProfileGpuPass gpuPasses[CB_PROFILE_GPU_QUERIES];
+static int gpuPassCount = 0;
+static int gpuFrame = 0;
+static bool gpuQueryActive = false;
+static bool gpuInitialized = false;
+
+void cbProfileGpuBegin(const char *name) {
+    if (!cbProfileIsEnabled() || gpuQueryActive) return; // time elapsed queries can not nest
+
+    struct cbProfileGpuFrame *frame = &gpuFrames[gpuFrame];
+    if (!gpuInitialized) {
+        for (int i = 0; i < CB_PROFILE_GPU_FRAMES; i++) {
+            glGenQueries(CB_PROFILE_GPU_QUERIES, gpuFrames[i].queries);
+            gpuFrames[i].count = 0;
+        }
+        gpuInitialized = true;
+    }
+    if (frame->count == CB_PROFILE_GPU_QUERIES) return; // pool is exhausted
+
+    frame->names[frame->count] = name;
+    frame->begins[frame->count] = cbNanoTime();
+    frame->frame = atomic_load(&frameIndex);
+    glBeginQuery(GL_TIME_ELAPSED, frame->queries[frame->count]);
+    gpuQueryActive = true;
+}
+
+void cbProfileGpuEnd() {
+    if (!gpuQueryActive) return;
+    glEndQuery(GL_TIME_ELAPSED);
+    gpuFrames[gpuFrame].count++;
+    gpuQueryActive = false;
+}
+
+static struct cbProfileGpuPass* findGpuPass(const char *name) {
+    for (int i = 0; i < gpuPassCount; i++) {
+        if (strcmp(gpuPasses[i].name, name) == 0) {
+            return &gpuPasses[i];
+        }
+    }
+    if (gpuPassCount == CB_PROFILE_GPU_QUERIES) return NULL;
+    gpuPasses[gpuPassCount].name = name;
+    gpuPasses[gpuPassCount].time = 0;
+    gpuPasses[gpuPassCount].frame = 0;
+    return &gpuPasses[gpuPassCount++];
+}
+
+void cbProfileGpuFrame() {
+    if (!gpuInitialized) return;
+
+    // oldest frame is reused, read its results without waiting
+    gpuFrame = (gpuFrame + 1) % CB_PROFILE_GPU_FRAMES;
+    struct cbProfileGpuFrame *frame = &gpuFrames[gpuFrame];
+    for (int i = 0; i < frame->count; i++) {
+        GLuint available = 0;
+        glGetQueryObjectuiv(frame->queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) continue; // gpu is too far behind, drop it
+
+        GLuint64 elapsed;
+        glGetQueryObjectui64v(frame->queries[i], GL_QUERY_RESULT, &elapsed);
+
+        // sum passes of same name in frame
+        struct cbProfileGpuPass *pass = findGpuPass(frame->names[i]);
+        if (pass != NULL) {
+            if (pass->frame != frame->frame) {
+                pass->frame = frame->frame;
+                pass->time = 0;
+            }
+            pass->time += (long long) elapsed;
+        }
+
+        // gpu track in trace, aligned to cpu issue time
+        pushZone(frame->names[i], frame->begins[i], frame->begins[i] + (long long) elapsed, 0, frame->frame);
+    }
+    frame->count = 0;
+}
+
+long long cbProfileGpuTime(const char *name) {
+    for (int i = 0; i < gpuPassCount; i++) {
+        if (strcmp(gpuPasses[i].name, name) == 0) {
+            return gpuPasses[i].time;
+        }
+    }
+    return 0;
+}
+
+void cbProfileDestroyGpu() {
+    if (!gpuInitialized) return;
+    for (int i = 0; i < CB_PROFILE_GPU_FRAMES; i++) {
+        glDeleteQueries(CB_PROFILE_GPU_QUERIES, gpuFrames[i].queries);
+    }
+    gpuInitialized = false;
+    gpuQueryActive = false;
+}
+
+// calls func for every complete zone in ring buffer
+static void forEachZone(void (*func)(struct cbProfileZone *zone, void *data), void *data) {
+    uint_fast64_t last = atomic_load_explicit(&writeIndex, memory_order_acquire);
+    uint_fast64_t first = last > CB_PROFILE_RING_SIZE ? last - CB_PROFILE_RING_SIZE : 0;
+
+    for (uint_fast64_t i = first; i < last; i++) {
+        struct cbProfileZone *zone = &zones[i & (CB_PROFILE_RING_SIZE - 1)];
+        if (atomic_load_explicit(&zone->sequence, memory_order_acquire) != i + 1) {
+            continue; // being written or already overwritten
+        }
+        struct cbProfileZone copy;
+        memcpy(&copy, zone, sizeof(copy));
+        atomic_thread_fence(memory_order_acquire); // copy is done before check
+        if (atomic_load_explicit(&zone->sequence, memory_order_relaxed) != i + 1) {
+            continue; // overwritten while copying
+        }
+        func(&copy, data);
+    }
+}
+
+struct zoneTime {
+    const char *name;
+    unsigned int frame;
+    long long total;
+};
+
+static void sumZone(struct cbProfileZone *zone, void *data) {
+    struct zoneTime *time = data;
+    if (zone->frame == time->frame && strcmp(zone->name, time->name) == 0) {
+        time->total += zone->end - zone->begin;
+    }
+}
+
+long long cbProfileZoneTime(const char *name, unsigned int frame) {
+    struct zoneTime time;
+    time.name = name;
+    time.frame = frame;
+    time.total = 0;
+    forEachZone(sumZone, &time);
+    return time.total;
+}
+
+struct exportState {
+    FILE *file;
+    bool first;
+};
+
+static void exportZone(struct cbProfileZone *zone, void *data) {
+    struct exportState *state = data;
+    fprintf(state->file, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%u}}",
+        state->first ? "" : ",", zone->name, zone->thread, zone->begin / 1000.0, (zone->end - zone->begin) / 1000.0, zone->frame);
+    state->first = false;
+}
+
+bool cbProfileExport(const char *path) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        return false;
+    }
+
+    struct exportState state;
+    state.file = file;
+    state.first = true;
+    fprintf(file, "{\"traceEvents\":[");
+    fprintf(file, "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":0,\"args\":{\"name\":\"gpu\"}}");
+    state.first = false;
+    forEachZone(exportZone, &state);
+    fprintf(file, "\n]}\n");
+    return fclose(file) == 0;
+}
+
+static cbRenderStats renderStats;
+static cbRenderStats renderHistory[CB_RENDER_STATS_HISTORY];
+static int renderHistoryNext = 0;
+static int renderHistoryCount = 0;
+
+cbRenderStats* cbRenderStatsCurrent() {
+    return &renderStats;
+}
+
+bool cbGetRenderStats(cbRenderStats *stats, int framesAgo) {
+    if (framesAgo < 0 || framesAgo >= renderHistoryCount) {
+        return false;
+    }
+    int index = (renderHistoryNext - 1 - framesAgo + CB_RENDER_STATS_HISTORY) % CB_RENDER_STATS_HISTORY;
+    *stats = renderHistory[index];
+    return true;
+}
+
+void cbRenderStatsFrame() {
+    renderHistory[renderHistoryNext] = renderStats;
+    renderHistoryNext = (renderHistoryNext + 1) % CB_RENDER_STATS_HISTORY;
+    if (renderHistoryCount < CB_RENDER_STATS_HISTORY) {
+        renderHistoryCount++;
+    }
+    memset(&renderStats, 0, sizeof(renderStats));
+}
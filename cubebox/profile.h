@@ -0,0 +1,83 @@
+// cpu frame profiler
+// zones are recorded to ring buffer and exported as chrome trace (chrome://tracing)
+#ifndef CB_PROFILE_H
+#define CB_PROFILE_H
+
+#include <stdbool.h>
+
+// zones kept in memory, power of two
+#ifndef CB_PROFILE_RING_SIZE
+    #define CB_PROFILE_RING_SIZE 16384
+#endif
+
+// gpu queries per frame and frames in flight
+#ifndef CB_PROFILE_GPU_QUERIES
+    #define CB_PROFILE_GPU_QUERIES 64
+#endif
+#ifndef CB_PROFILE_GPU_FRAMES
+    #define CB_PROFILE_GPU_FRAMES 4
+#endif
+
+// disabled by default
+void cbProfileEnable(bool enable);
+bool cbProfileIsEnabled();
+
+// begin/end named zone on current thread, zones can be nested
+// name must stay valid while profiling (string literal)
+void cbProfileBegin(const char *name);
+void cbProfileEnd();
+
+// profiles following statement or block
+// CB_PROFILE("ai") { updateAI(); }
+#define CB_PROFILE(name) for (int cbProfileOnce = (cbProfileBegin(name), 1); cbProfileOnce; cbProfileOnce = (cbProfileEnd(), 0))
+
+// starts new frame, called by cbRun
+void cbProfileFrame();
+unsigned int cbProfileFrameIndex();
+
+// total nanoseconds spent in zone during frame, if still in ring buffer
+long long cbProfileZoneTime(const char *name, unsigned int frame);
+
+// gpu time of passes with GL_TIME_ELAPSED queries, needs current gl context
+// queries can not nest, inner begin is ignored
+// results are read back CB_PROFILE_GPU_FRAMES frames later and exported on gpu track
+void cbProfileGpuBegin(const char *name);
+void cbProfileGpuEnd();
+
+// reads finished queries, called by cbRun after swap
+void cbProfileGpuFrame();
+
+// nanoseconds of all passes with name in last resolved frame
+long long cbProfileGpuTime(const char *name);
+
+// frees queries, call before gl context is destroyed
+void cbProfileDestroyGpu();
+
+// writes zones in ring buffer to chrome trace json
+bool cbProfileExport(const char *path);
+
+// renderer counters, filled by 2d and font renderers
+typedef struct {
+    int drawCalls;
+    int vertices;
+    long long bytesUploaded; // vertices and textures
+    int textureBinds;
+    int textureFlushes; // flushes caused by texture change
+    int glyphMisses; // glyphs rasterized
+} cbRenderStats;
+
+// frames kept in history
+#ifndef CB_RENDER_STATS_HISTORY
+    #define CB_RENDER_STATS_HISTORY 120
+#endif
+
+// counters of frame being rendered, renderers add to it
+cbRenderStats* cbRenderStatsCurrent();
+
+// stats of finished frame, 0 - last frame, returns false if not in history
+bool cbGetRenderStats(cbRenderStats *stats, int framesAgo);
+
+// moves current counters to history and resets them, called by cbRun
+void cbRenderStatsFrame();
+
+#endif
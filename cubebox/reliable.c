@@ -0,0 +1,543 @@
+#include "reliable.h"
+#include "stretchy_buffer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// packet: sequence u16, ack u16, ack bits u32, flags u8, then messages
+// with extra acks flag: block count u8 and blocks of ack u16, ack bits u32 before messages
+// message: channel u8, id u16, length u16, fragment u8, fragment count u8, then data
+#define CB_RELIABLE_HEADER 9
+#define CB_RELIABLE_ACK_BLOCK 6
+#define CB_RELIABLE_ACK_BLOCKS ((CB_RELIABLE_WINDOW + 32) / 33) // with main ack cover whole window
+#define CB_RELIABLE_MAX_HEADER (CB_RELIABLE_HEADER + 1 + CB_RELIABLE_ACK_BLOCKS * CB_RELIABLE_ACK_BLOCK)
+#define CB_RELIABLE_MESSAGE_HEADER 7
+#define CB_RELIABLE_FRAGMENT (CB_RELIABLE_MTU - CB_RELIABLE_MAX_HEADER - CB_RELIABLE_MESSAGE_HEADER)
+#define CB_RELIABLE_MAX_FRAGMENTS 255
+#define CB_RELIABLE_HAS_ACK 1 // flags, ack fields are valid
+#define CB_RELIABLE_EXTRA_ACKS 2 // flags, ack blocks follow header
+
+// queued or in flight message, fragments are queued separately
+struct cbOutMessage {
+    int key; // referenced by sent packets
+    int channel;
+    bool reliable;
+    bool done; // acked or sent unreliable, removed on compact
+    unsigned short id;
+    int fragment, fragmentCount; // fragmentCount 1 if whole message
+    char* data;
+    int length;
+    double lastSent; // < 0 - never sent
+};
+
+struct cbReceivedPacket {
+    bool used;
+    unsigned short sequence;
+};
+
+struct cbSentPacket {
+    bool used; // waiting for ack
+    unsigned short sequence;
+    double time;
+    int* keys; // stretchy buffer, reliable messages carried
+};
+
+// message being received
+struct cbInSlot {
+    bool used;
+    bool delivered; // unordered, kept to drop duplicates
+    unsigned short id;
+    char* data;
+    int length;
+    int fragmentCount;
+    int fragmentsLeft;
+    bool* fragments; // received flags
+};
+
+struct cbInChannel {
+    cbChannelMode mode;
+    unsigned short nextId; // reliable - first not delivered, sequenced - newest delivered + 1
+    struct cbInSlot slots[CB_RELIABLE_WINDOW];
+};
+
+struct cbEndpoint {
+    void (*send)(void* user, const char* data, int length);
+    void* user;
+    cbSocket socket; // udp endpoint
+    cbAddress peer;
+
+    double time; // of last update
+    unsigned short sequence; // next packet
+    bool hasRemote;
+    unsigned short remoteSequence; // newest received
+    struct cbReceivedPacket received[CB_RELIABLE_WINDOW]; // for ack bits and duplicates
+    unsigned short* unacked; // stretchy buffer, received since last sent packet
+    bool ackPending;
+
+    struct cbOutMessage* queue; // stretchy buffer
+    int nextKey;
+    unsigned short nextId[CB_RELIABLE_CHANNELS];
+    struct cbSentPacket sent[CB_RELIABLE_WINDOW];
+    struct cbInChannel in[CB_RELIABLE_CHANNELS];
+
+    cbEndpointMessage* delivered; // stretchy buffer
+    int deliveredHead;
+    char* lastData; // returned by last cbEndpointReceive
+
+    cbEndpointStats stats;
+    bool hasRtt;
+};
+
+// 16 bit sequence, wraps
+static bool sequenceGreater(unsigned short a, unsigned short b) {
+    return ((a > b) && (a - b <= 32768)) || ((a < b) && (b - a > 32768));
+}
+
+static void writeU16(char* out, unsigned short value) {
+    out[0] = (char) (value >> 8);
+    out[1] = (char) value;
+}
+
+static unsigned short readU16(const char* in) {
+    return (unsigned short) (((unsigned char) in[0] << 8) | (unsigned char) in[1]);
+}
+
+static void writeU32(char* out, unsigned int value) {
+    writeU16(out, (unsigned short) (value >> 16));
+    writeU16(out + 2, (unsigned short) value);
+}
+
+static unsigned int readU32(const char* in) {
+    return ((unsigned int) readU16(in) << 16) | readU16(in + 2);
+}
+
+cbEndpoint* cbCreateEndpoint(void (*send)(void* user, const char* data, int length), void* user) {
+    cbEndpoint* endpoint = calloc(1, sizeof(cbEndpoint));
+    endpoint->send = send;
+    endpoint->user = user;
+    endpoint->socket = -1;
+    endpoint->stats.rtt = 0.1; // until first ack
+    for (int i = 0; i < CB_RELIABLE_CHANNELS; i++) {
+        endpoint->in[i].mode = CB_CHANNEL_RELIABLE_ORDERED;
+    }
+    return endpoint;
+}
+
+static void sendUdp(void* user, const char* data, int length) {
+    cbEndpoint* endpoint = user;
+    cbSocketSendTo(endpoint->socket, &endpoint->peer, data, length);
+}
+
+cbEndpoint* cbCreateUdpEndpoint(cbSocket s, const cbAddress* peer) {
+    cbEndpoint* endpoint = cbCreateEndpoint(sendUdp, NULL);
+    endpoint->user = endpoint;
+    endpoint->socket = s;
+    endpoint->peer = *peer;
+    return endpoint;
+}
+
+static void clearSlot(struct cbInSlot* slot) {
+    free(slot->data);
+    free(slot->fragments);
+    memset(slot, 0, sizeof(*slot));
+}
+
+void cbDestroyEndpoint(cbEndpoint* endpoint) {
+    for (int i = 0; i < sb_count(endpoint->queue); i++) {
+        free(endpoint->queue[i].data);
+    }
+    sb_free(endpoint->queue);
+    sb_free(endpoint->unacked);
+    for (int i = 0; i < CB_RELIABLE_WINDOW; i++) {
+        sb_free(endpoint->sent[i].keys);
+    }
+    for (int c = 0; c < CB_RELIABLE_CHANNELS; c++) {
+        for (int i = 0; i < CB_RELIABLE_WINDOW; i++) {
+            clearSlot(&endpoint->in[c].slots[i]);
+        }
+    }
+    for (int i = endpoint->deliveredHead; i < sb_count(endpoint->delivered); i++) {
+        free(endpoint->delivered[i].data);
+    }
+    sb_free(endpoint->delivered);
+    free(endpoint->lastData);
+    free(endpoint);
+}
+
+void cbEndpointSetChannel(cbEndpoint* endpoint, int channel, cbChannelMode mode) {
+    if (channel < 0 || channel >= CB_RELIABLE_CHANNELS) return;
+    endpoint->in[channel].mode = mode;
+}
+
+bool cbEndpointSend(cbEndpoint* endpoint, int channel, const char* data, int length) {
+    if (channel < 0 || channel >= CB_RELIABLE_CHANNELS || length < 0) {
+        return false;
+    }
+
+    bool reliable = endpoint->in[channel].mode != CB_CHANNEL_UNRELIABLE_SEQUENCED;
+    int fragmentCount = length <= CB_RELIABLE_FRAGMENT ? 1 : (length + CB_RELIABLE_FRAGMENT - 1) / CB_RELIABLE_FRAGMENT;
+    if (fragmentCount > CB_RELIABLE_MAX_FRAGMENTS || (!reliable && fragmentCount > 1)) {
+        printf("message of %d bytes is too big for channel %d\n", length, channel);
+        return false;
+    }
+
+    unsigned short id = endpoint->nextId[channel]++;
+    for (int i = 0; i < fragmentCount; i++) {
+        int offset = i * CB_RELIABLE_FRAGMENT;
+        int size = length - offset < CB_RELIABLE_FRAGMENT ? length - offset : CB_RELIABLE_FRAGMENT;
+
+        struct cbOutMessage message;
+        message.key = endpoint->nextKey++;
+        message.channel = channel;
+        message.reliable = reliable;
+        message.done = false;
+        message.id = id;
+        message.fragment = i;
+        message.fragmentCount = fragmentCount;
+        message.data = malloc(size > 0 ? size : 1);
+        memcpy(message.data, data + offset, size);
+        message.length = size;
+        message.lastSent = -1.0;
+        sb_push(endpoint->queue, message);
+    }
+    return true;
+}
+
+static void deliver(cbEndpoint* endpoint, int channel, char* data, int length) {
+    cbEndpointMessage message;
+    message.channel = channel;
+    message.data = data;
+    message.length = length;
+    sb_push(endpoint->delivered, message);
+}
+
+static void receiveMessage(cbEndpoint* endpoint, int channel, unsigned short id, int fragment, int fragmentCount, const char* data, int length) {
+    struct cbInChannel* in = &endpoint->in[channel];
+
+    if (in->mode == CB_CHANNEL_UNRELIABLE_SEQUENCED) {
+        if (fragmentCount != 1) return;
+        if (id != in->nextId && !sequenceGreater(id, in->nextId)) return; // old
+        char* copy = malloc(length > 0 ? length : 1);
+        memcpy(copy, data, length);
+        deliver(endpoint, channel, copy, length);
+        in->nextId = id + 1;
+        return;
+    }
+
+    // outside of window, already delivered
+    if ((unsigned short) (id - in->nextId) >= CB_RELIABLE_WINDOW) return;
+
+    struct cbInSlot* slot = &in->slots[id & (CB_RELIABLE_WINDOW - 1)];
+    if (!slot->used) {
+        slot->used = true;
+        slot->id = id;
+        slot->data = malloc(fragmentCount * CB_RELIABLE_FRAGMENT);
+        slot->length = 0;
+        slot->fragmentCount = fragmentCount;
+        slot->fragmentsLeft = fragmentCount;
+        slot->fragments = calloc(fragmentCount, sizeof(bool));
+    }
+    if (slot->id != id || slot->fragmentCount != fragmentCount) return; // malformed
+    if (slot->fragmentsLeft == 0 || slot->fragments[fragment]) return; // duplicate
+
+    slot->fragments[fragment] = true;
+    slot->fragmentsLeft--;
+    memcpy(slot->data + fragment * CB_RELIABLE_FRAGMENT, data, length);
+    slot->length += length;
+    if (slot->fragmentsLeft > 0) return;
+
+    if (in->mode == CB_CHANNEL_RELIABLE_UNORDERED) {
+        deliver(endpoint, channel, slot->data, slot->length);
+        slot->data = NULL;
+        slot->delivered = true;
+    }
+
+    // slide window over complete messages
+    while (true) {
+        struct cbInSlot* next = &in->slots[in->nextId & (CB_RELIABLE_WINDOW - 1)];
+        if (!next->used || next->id != in->nextId || next->fragmentsLeft > 0) break;
+        if (!next->delivered) {
+            deliver(endpoint, channel, next->data, next->length);
+            next->data = NULL;
+        }
+        clearSlot(next);
+        in->nextId++;
+    }
+}
+
+static void ackPacket(cbEndpoint* endpoint, unsigned short sequence, double time) {
+    struct cbSentPacket* packet = &endpoint->sent[sequence & (CB_RELIABLE_WINDOW - 1)];
+    if (!packet->used || packet->sequence != sequence) return;
+
+    for (int i = 0; i < sb_count(packet->keys); i++) {
+        for (int j = 0; j < sb_count(endpoint->queue); j++) {
+            if (endpoint->queue[j].key == packet->keys[i]) {
+                endpoint->queue[j].done = true;
+                break;
+            }
+        }
+    }
+
+    double sample = time - packet->time; // receive time, not rounded to updates
+    if (sample < 0.0) {
+        sample = 0.0;
+    }
+    if (!endpoint->hasRtt) {
+        endpoint->stats.rtt = sample;
+        endpoint->hasRtt = true;
+    } else {
+        endpoint->stats.rtt += (sample - endpoint->stats.rtt) * 0.125;
+    }
+
+    packet->used = false;
+    if (packet->keys != NULL) {
+        stb__sbn(packet->keys) = 0;
+    }
+}
+
+static void ackPackets(cbEndpoint* endpoint, unsigned short ack, unsigned int ackBits, double time) {
+    ackPacket(endpoint, ack, time);
+    for (int i = 0; i < 32; i++) {
+        if (ackBits & (1u << i)) {
+            ackPacket(endpoint, ack - i - 1, time);
+        }
+    }
+}
+
+static bool isReceived(cbEndpoint* endpoint, unsigned short sequence) {
+    struct cbReceivedPacket* packet = &endpoint->received[sequence & (CB_RELIABLE_WINDOW - 1)];
+    return packet->used && packet->sequence == sequence;
+}
+
+// received packets among 32 before ack
+static unsigned int ackBitsBefore(cbEndpoint* endpoint, unsigned short ack) {
+    unsigned int bits = 0;
+    for (int i = 0; i < 32; i++) {
+        if (isReceived(endpoint, ack - i - 1)) {
+            bits |= 1u << i;
+        }
+    }
+    return bits;
+}
+
+void cbEndpointReceivePacket(cbEndpoint* endpoint, const char* data, int length, double time) {
+    if (length < CB_RELIABLE_HEADER) return;
+
+    unsigned short sequence = readU16(data);
+    int flags = (unsigned char) data[8];
+    int offset = CB_RELIABLE_HEADER;
+    int blocks = 0;
+    if (flags & CB_RELIABLE_EXTRA_ACKS) {
+        if (length < offset + 1) return;
+        blocks = (unsigned char) data[offset++];
+        if (blocks > CB_RELIABLE_ACK_BLOCKS || length < offset + blocks * CB_RELIABLE_ACK_BLOCK) return;
+    }
+
+    // remember for acks, duplicates and packets older than window are dropped
+    if (!endpoint->hasRemote) {
+        endpoint->hasRemote = true;
+        endpoint->remoteSequence = sequence;
+    } else if (sequenceGreater(sequence, endpoint->remoteSequence)) {
+        // slots between are reused by newer sequences
+        int diff = (unsigned short) (sequence - endpoint->remoteSequence);
+        for (int i = 1; i < diff && i <= CB_RELIABLE_WINDOW; i++) {
+            endpoint->received[(unsigned short) (endpoint->remoteSequence + i) & (CB_RELIABLE_WINDOW - 1)].used = false;
+        }
+        endpoint->remoteSequence = sequence;
+    } else if ((unsigned short) (endpoint->remoteSequence - sequence) >= CB_RELIABLE_WINDOW) {
+        return;
+    }
+    if (isReceived(endpoint, sequence)) return;
+    endpoint->received[sequence & (CB_RELIABLE_WINDOW - 1)].used = true;
+    endpoint->received[sequence & (CB_RELIABLE_WINDOW - 1)].sequence = sequence;
+    sb_push(endpoint->unacked, sequence);
+    endpoint->stats.packetsReceived++;
+
+    if (flags & CB_RELIABLE_HAS_ACK) {
+        ackPackets(endpoint, readU16(data + 2), readU32(data + 4), time);
+    }
+    for (int i = 0; i < blocks; i++) {
+        ackPackets(endpoint, readU16(data + offset), readU32(data + offset + 2), time);
+        offset += CB_RELIABLE_ACK_BLOCK;
+    }
+
+    while (offset + CB_RELIABLE_MESSAGE_HEADER <= length) {
+        int channel = (unsigned char) data[offset];
+        unsigned short id = readU16(data + offset + 1);
+        int size = readU16(data + offset + 3);
+        int fragment = (unsigned char) data[offset + 5];
+        int fragmentCount = (unsigned char) data[offset + 6];
+        offset += CB_RELIABLE_MESSAGE_HEADER;
+
+        // malformed packet
+        if (offset + size > length || channel >= CB_RELIABLE_CHANNELS || fragment >= fragmentCount || size > CB_RELIABLE_FRAGMENT) break;
+        if (fragment < fragmentCount - 1 && size != CB_RELIABLE_FRAGMENT) break;
+
+        receiveMessage(endpoint, channel, id, fragment, fragmentCount, data + offset, size);
+        offset += size;
+        endpoint->ackPending = true; // ack only packets are not acked
+    }
+}
+
+bool cbEndpointReceive(cbEndpoint* endpoint, cbEndpointMessage* message) {
+    free(endpoint->lastData);
+    endpoint->lastData = NULL;
+
+    if (endpoint->deliveredHead >= sb_count(endpoint->delivered)) {
+        if (endpoint->delivered != NULL) {
+            stb__sbn(endpoint->delivered) = 0;
+        }
+        endpoint->deliveredHead = 0;
+        return false;
+    }
+
+    *message = endpoint->delivered[endpoint->deliveredHead++];
+    endpoint->lastData = message->data;
+    return true;
+}
+
+static int compareDistance(const void* a, const void* b) {
+    return *(const int*) a - *(const int*) b;
+}
+
+// writes acks of packet header, returns header size
+// packets received since last send and older than ack bits reach go in extra blocks
+static int writeAcks(cbEndpoint* endpoint, char* packet) {
+    writeU16(packet + 2, endpoint->remoteSequence);
+    writeU32(packet + 4, ackBitsBefore(endpoint, endpoint->remoteSequence));
+    int flags = endpoint->hasRemote ? CB_RELIABLE_HAS_ACK : 0;
+
+    // distance back from newest, blocks start at nearest not covered
+    int distances[CB_RELIABLE_WINDOW];
+    int count = 0;
+    for (int i = 0; i < sb_count(endpoint->unacked) && count < CB_RELIABLE_WINDOW; i++) {
+        int distance = (unsigned short) (endpoint->remoteSequence - endpoint->unacked[i]);
+        if (distance > 32 && distance < CB_RELIABLE_WINDOW) {
+            distances[count++] = distance;
+        }
+    }
+    qsort(distances, count, sizeof(int), compareDistance);
+
+    int size = CB_RELIABLE_HEADER + 1;
+    int blocks = 0;
+    int covered = 32;
+    for (int i = 0; i < count && blocks < CB_RELIABLE_ACK_BLOCKS; i++) {
+        if (distances[i] <= covered) continue;
+        unsigned short ack = endpoint->remoteSequence - distances[i];
+        writeU16(packet + size, ack);
+        writeU32(packet + size + 2, ackBitsBefore(endpoint, ack));
+        size += CB_RELIABLE_ACK_BLOCK;
+        blocks++;
+        covered = distances[i] + 32;
+    }
+
+    packet[8] = (char) (flags | (blocks > 0 ? CB_RELIABLE_EXTRA_ACKS : 0));
+    if (blocks == 0) {
+        return CB_RELIABLE_HEADER;
+    }
+    packet[CB_RELIABLE_HEADER] = (char) blocks;
+    return size;
+}
+
+static void sendPacket(cbEndpoint* endpoint, char* packet, int size, int** keys) {
+    writeU16(packet, endpoint->sequence);
+
+    // window moved past packet without ack
+    struct cbSentPacket* sent = &endpoint->sent[endpoint->sequence & (CB_RELIABLE_WINDOW - 1)];
+    if (sent->used) {
+        endpoint->stats.packetsLost++;
+    }
+    sb_free(sent->keys);
+    sent->used = true;
+    sent->sequence = endpoint->sequence;
+    sent->time = endpoint->time;
+    sent->keys = *keys;
+    *keys = NULL;
+
+    endpoint->send(endpoint->user, packet, size);
+    endpoint->sequence++;
+    endpoint->ackPending = false;
+    if (endpoint->unacked != NULL) {
+        stb__sbn(endpoint->unacked) = 0; // extra blocks are sent once
+    }
+    endpoint->stats.packetsSent++;
+}
+
+// removes acked and sent unreliable messages
+static void compactQueue(cbEndpoint* endpoint) {
+    int count = 0;
+    for (int i = 0; i < sb_count(endpoint->queue); i++) {
+        if (endpoint->queue[i].done) {
+            free(endpoint->queue[i].data);
+        } else {
+            endpoint->queue[count++] = endpoint->queue[i];
+        }
+    }
+    if (endpoint->queue != NULL) {
+        stb__sbn(endpoint->queue) = count;
+    }
+}
+
+void cbEndpointUpdate(cbEndpoint* endpoint, double time) {
+    endpoint->time = time;
+    compactQueue(endpoint);
+
+    double timeout = endpoint->stats.rtt * 1.5;
+    if (timeout < CB_RELIABLE_MIN_RESEND) {
+        timeout = CB_RELIABLE_MIN_RESEND;
+    }
+
+    // oldest not acked id limits ids in flight, receiver window is same size
+    bool hasOldest[CB_RELIABLE_CHANNELS] = {false};
+    unsigned short oldest[CB_RELIABLE_CHANNELS];
+
+    char packet[CB_RELIABLE_MTU];
+    int header = writeAcks(endpoint, packet);
+    int size = header;
+    int* keys = NULL; // stretchy buffer
+    for (int i = 0; i < sb_count(endpoint->queue); i++) {
+        struct cbOutMessage* message = &endpoint->queue[i];
+        if (message->reliable && !hasOldest[message->channel]) {
+            hasOldest[message->channel] = true;
+            oldest[message->channel] = message->id;
+        }
+        if (message->reliable && (unsigned short) (message->id - oldest[message->channel]) >= CB_RELIABLE_WINDOW) continue;
+        if (message->lastSent >= 0.0 && time - message->lastSent < timeout) continue;
+
+        if (size + CB_RELIABLE_MESSAGE_HEADER + message->length > CB_RELIABLE_MTU) {
+            sendPacket(endpoint, packet, size, &keys);
+            header = writeAcks(endpoint, packet);
+            size = header;
+        }
+
+        char* out = packet + size;
+        out[0] = (char) message->channel;
+        writeU16(out + 1, message->id);
+        writeU16(out + 3, (unsigned short) message->length);
+        out[5] = (char) message->fragment;
+        out[6] = (char) message->fragmentCount;
+        memcpy(out + CB_RELIABLE_MESSAGE_HEADER, message->data, message->length);
+        size += CB_RELIABLE_MESSAGE_HEADER + message->length;
+
+        if (message->reliable) {
+            if (message->lastSent >= 0.0) {
+                endpoint->stats.messagesResent++;
+            }
+            message->lastSent = time;
+            sb_push(keys, message->key);
+        } else {
+            message->done = true;
+        }
+    }
+
+    if (size > header || endpoint->ackPending) {
+        sendPacket(endpoint, packet, size, &keys);
+    }
+    sb_free(keys);
+    compactQueue(endpoint);
+}
+
+void cbEndpointGetStats(cbEndpoint* endpoint, cbEndpointStats* stats) {
+    *stats = endpoint->stats;
+}
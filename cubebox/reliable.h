@@ -0,0 +1,81 @@
+// reliable channels over datagrams
+// packets carry sequence, ack of last remote packet and bitfield of 32 before it
+// older packets received since last send are acked once in extra blocks, up to whole window
+// reliable messages are resent until packet carrying them is acked
+#ifndef CB_RELIABLE_H
+#define CB_RELIABLE_H
+
+#include "net.h"
+
+#include <stdbool.h>
+
+// largest packet, messages over it are fragmented
+#ifndef CB_RELIABLE_MTU
+    #define CB_RELIABLE_MTU 1200
+#endif
+
+#ifndef CB_RELIABLE_CHANNELS
+    #define CB_RELIABLE_CHANNELS 4
+#endif
+
+// packets tracked for acks and messages in flight per channel, must be power of two
+#ifndef CB_RELIABLE_WINDOW
+    #define CB_RELIABLE_WINDOW 256
+#endif
+
+// lower bound of resend timeout in seconds, timeout follows round trip time
+#ifndef CB_RELIABLE_MIN_RESEND
+    #define CB_RELIABLE_MIN_RESEND 0.02
+#endif
+
+typedef enum {
+    CB_CHANNEL_RELIABLE_ORDERED, // default
+    CB_CHANNEL_RELIABLE_UNORDERED,
+    CB_CHANNEL_UNRELIABLE_SEQUENCED // older than last received are dropped
+} cbChannelMode;
+
+typedef struct cbEndpoint cbEndpoint;
+
+typedef struct {
+    int channel;
+    char* data; // valid until next cbEndpointReceive
+    int length;
+} cbEndpointMessage;
+
+typedef struct {
+    double rtt; // smoothed, seconds
+    int packetsSent;
+    int packetsReceived;
+    int packetsLost; // not acked when window moved past them
+    int messagesResent;
+} cbEndpointStats;
+
+// send is called with each packet to put on the wire
+cbEndpoint* cbCreateEndpoint(void (*send)(void* user, const char* data, int length), void* user);
+
+// sends packets to peer through udp socket
+cbEndpoint* cbCreateUdpEndpoint(cbSocket s, const cbAddress* peer);
+
+void cbDestroyEndpoint(cbEndpoint* endpoint);
+
+// both sides must use same modes
+void cbEndpointSetChannel(cbEndpoint* endpoint, int channel, cbChannelMode mode);
+
+// queues message, sent with next cbEndpointUpdate
+// reliable messages up to 255 packets, unreliable up to one packet
+bool cbEndpointSend(cbEndpoint* endpoint, int channel, const char* data, int length);
+
+// feed packet received from peer
+// time when it arrived, same clock as cbEndpointUpdate, used for round trip
+void cbEndpointReceivePacket(cbEndpoint* endpoint, const char* data, int length, double time);
+
+// pops delivered message, returns false if none
+bool cbEndpointReceive(cbEndpoint* endpoint, cbEndpointMessage* message);
+
+// sends queued messages, resends not acked ones and acks received packets
+// time in seconds from any fixed point, used for resends and round trip time
+void cbEndpointUpdate(cbEndpoint* endpoint, double time);
+
+void cbEndpointGetStats(cbEndpoint* endpoint, cbEndpointStats* stats);
+
+#endif
@@ -0,0 +1,227 @@
+#include "render.h"
+#include "profile.h"
+#include "glad.h"
+#include "stretchy_buffer.h"
+#include "tinycthread.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// command header, followed by data
+struct cbRenderCommand {
+    void (*func)(void *data);
+    int size; // data size, aligned
+};
+
+#define CB_RENDER_ALIGN 8
+#define CB_RENDER_HEADER ((sizeof(struct cbRenderCommand) + CB_RENDER_ALIGN - 1) & ~(CB_RENDER_ALIGN - 1))
+
+// double buffered command lists, main thread records one while render thread executes other
+static char *recordList = NULL; // stretchy buffer
+static char *executeList = NULL; // stretchy buffer
+
+static bool threaded = false;
+static void (*bindFunc)(bool current) = NULL;
+static void (*presentFunc)(void) = NULL;
+
+// render thread state, guarded by mutex
+static thrd_t renderThread;
+static mtx_t renderMutex;
+static cnd_t renderCond;
+static bool renderStop = false;
+static bool frameReady = false; // executeList is waiting for render thread
+static bool frameBusy = false; // executeList is not done
+static void (*callFunc)(void *data) = NULL; // synchronous call request
+static void *callData = NULL;
+
+void cbRenderSubmit(void (*func)(void *data), const void *data, int size) {
+    if (!threaded) {
+        func((void*) data);
+        return;
+    }
+
+    // data is copied after header
+    int aligned = (size + CB_RENDER_ALIGN - 1) & ~(CB_RENDER_ALIGN - 1);
+    char *record = sb_add(recordList, (int) CB_RENDER_HEADER + aligned);
+    struct cbRenderCommand *command = (struct cbRenderCommand*) record;
+    command->func = func;
+    command->size = aligned;
+    if (size > 0) {
+        memcpy(record + CB_RENDER_HEADER, data, size);
+    }
+}
+
+void cbRenderCall(void (*func)(void *data), void *data) {
+    if (!threaded) {
+        func(data);
+        return;
+    }
+
+    // executed between frames by render thread
+    mtx_lock(&renderMutex);
+    callFunc = func;
+    callData = data;
+    cnd_broadcast(&renderCond);
+    while (callFunc != NULL) {
+        cnd_wait(&renderCond, &renderMutex);
+    }
+    mtx_unlock(&renderMutex);
+}
+
+bool cbRenderIsThreaded() {
+    return threaded;
+}
+
+struct clearCommand {
+    float r, g, b, a;
+};
+
+static void clearScreen(void *data) {
+    struct clearCommand *clear = data;
+    glClearColor(clear->r, clear->g, clear->b, clear->a);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
+void cbClearScreen(float r, float g, float b, float a) {
+    struct clearCommand clear = {r, g, b, a};
+    cbRenderSubmit(clearScreen, &clear, sizeof(clear));
+}
+
+static void executeCommands(char *list) {
+    int offset = 0;
+    while (offset < sb_count(list)) {
+        struct cbRenderCommand *command = (struct cbRenderCommand*) (list + offset);
+        command->func(list + offset + CB_RENDER_HEADER);
+        offset += (int) CB_RENDER_HEADER + command->size;
+    }
+}
+
+static void executeRecorded(void *data) {
+    executeCommands(recordList);
+    if (recordList != NULL) {
+        stb__sbn(recordList) = 0; // rest of frame is recorded from start
+    }
+}
+
+void cbRenderFinish() {
+    if (!threaded) return;
+
+    // previous frame first, synchronous calls would run before it
+    mtx_lock(&renderMutex);
+    while (frameBusy) {
+        cnd_wait(&renderCond, &renderMutex);
+    }
+    mtx_unlock(&renderMutex);
+
+    // main thread waits, render thread may use record list
+    cbRenderCall(executeRecorded, NULL);
+}
+
+static int renderThreadFunc(void *arg) {
+    bindFunc(true);
+
+    mtx_lock(&renderMutex);
+    while (true) {
+        while (!frameReady && callFunc == NULL && !renderStop) {
+            cnd_wait(&renderCond, &renderMutex);
+        }
+
+        // synchronous calls first, they are waited by main thread
+        if (callFunc != NULL) {
+            mtx_unlock(&renderMutex);
+            callFunc(callData);
+            mtx_lock(&renderMutex);
+            callFunc = NULL;
+            cnd_broadcast(&renderCond);
+            continue;
+        }
+
+        if (frameReady) {
+            frameReady = false;
+            mtx_unlock(&renderMutex);
+
+            cbProfileBegin("execute");
+            executeCommands(executeList);
+            cbProfileEnd();
+            presentFunc();
+
+            mtx_lock(&renderMutex);
+            frameBusy = false;
+            cnd_broadcast(&renderCond);
+            continue;
+        }
+
+        if (renderStop) break;
+    }
+    mtx_unlock(&renderMutex);
+
+    bindFunc(false);
+    return 0;
+}
+
+void cbStartRenderThread(void (*bind)(bool current), void (*present)(void)) {
+    bindFunc = bind;
+    presentFunc = present;
+    renderStop = false;
+    frameReady = false;
+    frameBusy = false;
+
+    mtx_init(&renderMutex, mtx_plain);
+    cnd_init(&renderCond);
+
+    // context moves to render thread
+    bindFunc(false);
+    threaded = true;
+    if (thrd_create(&renderThread, renderThreadFunc, NULL) != thrd_success) {
+        printf("render thread can not be started\n");
+        threaded = false;
+        bindFunc(true);
+        mtx_destroy(&renderMutex);
+        cnd_destroy(&renderCond);
+    }
+}
+
+void cbRenderFrame() {
+    if (!threaded) return;
+
+    // wait previous frame, then swap lists
+    mtx_lock(&renderMutex);
+    while (frameBusy) {
+        cnd_wait(&renderCond, &renderMutex);
+    }
+    char *list = executeList;
+    executeList = recordList;
+    recordList = list;
+    if (recordList != NULL) {
+        stb__sbn(recordList) = 0; // keep memory
+    }
+    frameBusy = true;
+    frameReady = true;
+    cnd_broadcast(&renderCond);
+    mtx_unlock(&renderMutex);
+}
+
+void cbStopRenderThread() {
+    if (!threaded) return;
+
+    mtx_lock(&renderMutex);
+    while (frameBusy) {
+        cnd_wait(&renderCond, &renderMutex);
+    }
+    renderStop = true;
+    cnd_broadcast(&renderCond);
+    mtx_unlock(&renderMutex);
+
+    thrd_join(renderThread, NULL);
+    threaded = false;
+    mtx_destroy(&renderMutex);
+    cnd_destroy(&renderCond);
+
+    // commands recorded after last frame
+    bindFunc(true);
+    executeCommands(recordList);
+    sb_free(recordList);
+    sb_free(executeList);
+    recordList = NULL;
+    executeList = NULL;
+}
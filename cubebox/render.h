@@ -0,0 +1,35 @@
+// gl command lists
+// renderers record gl work as commands, with render thread enabled
+// commands of one frame are executed on render thread while next frame is recorded
+#ifndef CB_RENDER_H
+#define CB_RENDER_H
+
+#include <stdbool.h>
+
+// runs func with copy of size bytes of data on thread owning gl context
+// without render thread it is called immediately with data itself
+// use it for own gl calls, commands are executed in submit order
+void cbRenderSubmit(void (*func)(void *data), const void *data, int size);
+
+// runs func on thread owning gl context and waits for it
+// use it for gl calls returning values, like creating objects
+void cbRenderCall(void (*func)(void *data), void *data);
+
+// executes commands recorded so far in this frame and waits for them, without present
+// use it to read results of this frame, like pixels
+void cbRenderFinish();
+
+// true while render thread owns gl context
+bool cbRenderIsThreaded();
+
+// clears screen, same as glClearColor and glClear through command list
+void cbClearScreen(float r, float g, float b, float a);
+
+// used by cbRun
+// bind makes context current on calling thread or releases it
+// present swaps buffers at end of executed frame
+void cbStartRenderThread(void (*bind)(bool current), void (*present)(void));
+void cbRenderFrame(); // hands recorded frame to render thread
+void cbStopRenderThread();
+
+#endif
@@ -0,0 +1,367 @@
+#include "serialize.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <limits.h>
+
+/// BITS
+
+void cbInitBitWriter(cbBitWriter* writer, void* buffer, int capacity) {
+    writer->data = buffer;
+    writer->capacity = capacity;
+    writer->bits = 0;
+    writer->overflow = false;
+}
+
+int cbBitWriterBytes(cbBitWriter* writer) {
+    return (writer->bits + 7) / 8;
+}
+
+void cbWriteBits(cbBitWriter* writer, unsigned int value, int bits) {
+    if (bits < 32) {
+        value &= (1u << bits) - 1;
+    }
+    while (bits > 0) {
+        int byte = writer->bits >> 3;
+        int offset = writer->bits & 7;
+        if (byte >= writer->capacity) {
+            writer->overflow = true;
+            return;
+        }
+
+        int take = 8 - offset < bits ? 8 - offset : bits;
+        if (offset == 0) {
+            writer->data[byte] = 0;
+        }
+        writer->data[byte] |= (unsigned char) ((value & ((1u << take) - 1)) << offset);
+        value >>= take;
+        bits -= take;
+        writer->bits += take;
+    }
+}
+
+void cbWriteBool(cbBitWriter* writer, bool value) {
+    cbWriteBits(writer, value ? 1 : 0, 1);
+}
+
+void cbWriteVarint(cbBitWriter* writer, unsigned int value) {
+    do {
+        unsigned int group = value & 0x7f;
+        value >>= 7;
+        cbWriteBits(writer, group | (value != 0 ? 0x80 : 0), 8);
+    } while (value != 0);
+}
+
+void cbWriteSignedVarint(cbBitWriter* writer, int value) {
+    cbWriteVarint(writer, ((unsigned int) value << 1) ^ (unsigned int) (value >> 31));
+}
+
+void cbWriteFloat(cbBitWriter* writer, float value) {
+    unsigned int bits;
+    memcpy(&bits, &value, sizeof(bits));
+    cbWriteBits(writer, bits, 32);
+}
+
+static unsigned int quantize(float value, float min, float max, int bits) {
+    if (value < min) value = min;
+    if (value > max) value = max;
+    unsigned int steps = bits < 32 ? (1u << bits) - 1 : 0xffffffffu;
+    return (unsigned int) lroundf((value - min) / (max - min) * (float) steps);
+}
+
+void cbWriteQuantized(cbBitWriter* writer, float value, float min, float max, int bits) {
+    cbWriteBits(writer, quantize(value, min, max, bits), bits);
+}
+
+void cbInitBitReader(cbBitReader* reader, const void* buffer, int size) {
+    reader->data = buffer;
+    reader->size = size;
+    reader->bits = 0;
+    reader->overflow = false;
+}
+
+unsigned int cbReadBits(cbBitReader* reader, int bits) {
+    unsigned int value = 0;
+    int shift = 0;
+    while (bits > 0) {
+        int byte = reader->bits >> 3;
+        int offset = reader->bits & 7;
+        if (byte >= reader->size) {
+            reader->overflow = true;
+            return 0;
+        }
+
+        int take = 8 - offset < bits ? 8 - offset : bits;
+        unsigned int part = (reader->data[byte] >> offset) & ((1u << take) - 1);
+        value |= part << shift;
+        shift += take;
+        bits -= take;
+        reader->bits += take;
+    }
+    return value;
+}
+
+bool cbReadBool(cbBitReader* reader) {
+    return cbReadBits(reader, 1) != 0;
+}
+
+unsigned int cbReadVarint(cbBitReader* reader) {
+    unsigned int value = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        unsigned int group = cbReadBits(reader, 8);
+        value |= (group & 0x7f) << shift;
+        if (!(group & 0x80)) break;
+    }
+    return value;
+}
+
+int cbReadSignedVarint(cbBitReader* reader) {
+    unsigned int value = cbReadVarint(reader);
+    return (int) (value >> 1) ^ -(int) (value & 1);
+}
+
+float cbReadFloat(cbBitReader* reader) {
+    unsigned int bits = cbReadBits(reader, 32);
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+float cbReadQuantized(cbBitReader* reader, float min, float max, int bits) {
+    unsigned int steps = bits < 32 ? (1u << bits) - 1 : 0xffffffffu;
+    return min + (float) cbReadBits(reader, bits) / (float) steps * (max - min);
+}
+
+/// DELTA
+
+// values as written, quantized floats compare by steps
+static unsigned int fieldValue(const cbField* field, const void* entity) {
+    const char* at = (const char*) entity + field->offset;
+    switch (field->type) {
+    case CB_FIELD_INT:
+        return (unsigned int) *(const int*) at;
+    case CB_FIELD_FLOAT:
+        if (field->bits == 32) {
+            unsigned int bits;
+            memcpy(&bits, at, sizeof(bits));
+            return bits;
+        }
+        return quantize(*(const float*) at, field->min, field->max, field->bits);
+    case CB_FIELD_BOOL:
+        return *(const bool*) at ? 1 : 0;
+    }
+    return 0;
+}
+
+static void writeField(cbBitWriter* writer, const cbField* field, const void* entity) {
+    const char* at = (const char*) entity + field->offset;
+    switch (field->type) {
+    case CB_FIELD_INT:
+        if (field->bits == 0) {
+            cbWriteSignedVarint(writer, *(const int*) at);
+        } else {
+            cbWriteBits(writer, (unsigned int) *(const int*) at, field->bits);
+        }
+        break;
+    case CB_FIELD_FLOAT:
+        if (field->bits == 32) {
+            cbWriteFloat(writer, *(const float*) at);
+        } else {
+            cbWriteQuantized(writer, *(const float*) at, field->min, field->max, field->bits);
+        }
+        break;
+    case CB_FIELD_BOOL:
+        cbWriteBool(writer, *(const bool*) at);
+        break;
+    }
+}
+
+static void readField(cbBitReader* reader, const cbField* field, void* entity) {
+    char* at = (char*) entity + field->offset;
+    switch (field->type) {
+    case CB_FIELD_INT:
+        if (field->bits == 0) {
+            *(int*) at = cbReadSignedVarint(reader);
+        } else {
+            *(int*) at = (int) cbReadBits(reader, field->bits);
+        }
+        break;
+    case CB_FIELD_FLOAT:
+        if (field->bits == 32) {
+            *(float*) at = cbReadFloat(reader);
+        } else {
+            *(float*) at = cbReadQuantized(reader, field->min, field->max, field->bits);
+        }
+        break;
+    case CB_FIELD_BOOL:
+        *(bool*) at = cbReadBool(reader);
+        break;
+    }
+}
+
+void cbWriteDelta(cbBitWriter* writer, const cbSchema* schema, const void* baseline, const void* current) {
+    if (baseline == NULL) {
+        for (int i = 0; i < schema->fieldCount; i++) {
+            writeField(writer, &schema->fields[i], current);
+        }
+        return;
+    }
+
+    bool changed = false;
+    for (int i = 0; i < schema->fieldCount && !changed; i++) {
+        changed = fieldValue(&schema->fields[i], baseline) != fieldValue(&schema->fields[i], current);
+    }
+
+    // unchanged entity is one bit
+    cbWriteBool(writer, changed);
+    if (!changed) return;
+
+    for (int i = 0; i < schema->fieldCount; i++) {
+        bool dirty = fieldValue(&schema->fields[i], baseline) != fieldValue(&schema->fields[i], current);
+        cbWriteBool(writer, dirty);
+        if (dirty) {
+            writeField(writer, &schema->fields[i], current);
+        }
+    }
+}
+
+void cbReadDelta(cbBitReader* reader, const cbSchema* schema, const void* baseline, void* out) {
+    if (baseline == NULL) {
+        for (int i = 0; i < schema->fieldCount; i++) {
+            readField(reader, &schema->fields[i], out);
+        }
+        return;
+    }
+
+    if (out != baseline) {
+        memcpy(out, baseline, schema->size);
+    }
+    if (!cbReadBool(reader)) return;
+
+    for (int i = 0; i < schema->fieldCount; i++) {
+        if (cbReadBool(reader)) {
+            readField(reader, &schema->fields[i], out);
+        }
+    }
+}
+
+static int entityId(const cbSchema* schema, const void* entities, int index) {
+    return *(const int*) ((const char*) entities + index * schema->size + schema->idOffset);
+}
+
+void cbWriteSnapshot(cbBitWriter* writer, const cbSchema* schema, const void* baseline, int baselineCount, const void* current, int count) {
+    cbWriteVarint(writer, count);
+
+    int base = 0;
+    int previousId = 0;
+    for (int i = 0; i < count; i++) {
+        int id = entityId(schema, current, i);
+        const char* entity = (const char*) current + i * schema->size;
+        if (id < 0 || (i > 0 && id <= previousId)) {
+            writer->overflow = true; // not sorted, output is not valid
+            return;
+        }
+
+        // ids grow, gaps are short
+        cbWriteVarint(writer, (unsigned int) id - (unsigned int) previousId);
+        previousId = id;
+
+        while (base < baselineCount && entityId(schema, baseline, base) < id) {
+            base++;
+        }
+        bool inBaseline = base < baselineCount && entityId(schema, baseline, base) == id;
+        cbWriteBool(writer, inBaseline);
+        cbWriteDelta(writer, schema, inBaseline ? (const char*) baseline + base * schema->size : NULL, entity);
+    }
+}
+
+int cbReadSnapshot(cbBitReader* reader, const cbSchema* schema, const void* baseline, int baselineCount, void* out, int capacity) {
+    int count = (int) cbReadVarint(reader);
+    if (count < 0 || count > capacity) return -1;
+
+    int base = 0;
+    unsigned int id = 0;
+    for (int i = 0; i < count; i++) {
+        unsigned int gap = cbReadVarint(reader);
+        if ((i > 0 && gap == 0) || gap > (unsigned int) INT_MAX - id) {
+            return -1; // ids must grow and stay in int
+        }
+        id += gap;
+        char* entity = (char*) out + i * schema->size;
+
+        while (base < baselineCount && entityId(schema, baseline, base) < (int) id) {
+            base++;
+        }
+        bool inBaseline = cbReadBool(reader);
+        if (inBaseline && (base >= baselineCount || entityId(schema, baseline, base) != (int) id)) {
+            return -1; // wrong baseline
+        }
+        if (!inBaseline) {
+            memset(entity, 0, schema->size);
+        }
+        cbReadDelta(reader, schema, inBaseline ? (const char*) baseline + base * schema->size : NULL, entity);
+        *(int*) (entity + schema->idOffset) = (int) id;
+
+        if (reader->overflow) return -1;
+    }
+    return count;
+}
+
+/// HISTORY
+
+struct cbStoredSnapshot {
+    bool used;
+    unsigned int sequence;
+    char* entities;
+    int count;
+    int capacity;
+};
+
+struct cbSnapshotHistory {
+    cbSchema schema;
+    struct cbStoredSnapshot* snapshots;
+    int capacity;
+};
+
+cbSnapshotHistory* cbCreateSnapshotHistory(const cbSchema* schema, int capacity) {
+    cbSnapshotHistory* history = malloc(sizeof(cbSnapshotHistory));
+    history->schema = *schema;
+    history->snapshots = calloc(capacity, sizeof(struct cbStoredSnapshot));
+    history->capacity = capacity;
+    return history;
+}
+
+void cbDestroySnapshotHistory(cbSnapshotHistory* history) {
+    for (int i = 0; i < history->capacity; i++) {
+        free(history->snapshots[i].entities);
+    }
+    free(history->snapshots);
+    free(history);
+}
+
+void cbStoreSnapshot(cbSnapshotHistory* history, unsigned int sequence, const void* entities, int count) {
+    struct cbStoredSnapshot* snapshot = &history->snapshots[sequence % history->capacity];
+    if (snapshot->entities == NULL || snapshot->capacity < count) {
+        // empty snapshot still gets memory, NULL means not stored
+        int capacity = count > 0 ? count : 1;
+        free(snapshot->entities);
+        snapshot->entities = malloc(capacity * history->schema.size);
+        snapshot->capacity = capacity;
+    }
+    if (count > 0) {
+        memcpy(snapshot->entities, entities, count * history->schema.size);
+    }
+    snapshot->count = count;
+    snapshot->sequence = sequence;
+    snapshot->used = true;
+}
+
+const void* cbFindSnapshot(cbSnapshotHistory* history, unsigned int sequence, int* count) {
+    struct cbStoredSnapshot* snapshot = &history->snapshots[sequence % history->capacity];
+    if (!snapshot->used || snapshot->sequence != sequence) {
+        return NULL;
+    }
+    *count = snapshot->count;
+    return snapshot->entities;
+}
@@ -0,0 +1,104 @@
+// bit packing and delta compressed snapshots
+// values are packed lsb first, readers must read same sequence of calls
+#ifndef CB_SERIALIZE_H
+#define CB_SERIALIZE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/// BITS
+
+typedef struct {
+    unsigned char* data;
+    int capacity; // bytes
+    int bits; // written
+    bool overflow; // ran out of capacity or input was invalid, output is not valid
+} cbBitWriter;
+
+typedef struct {
+    const unsigned char* data;
+    int size; // bytes
+    int bits; // read
+    bool overflow; // read past end, values are zero
+} cbBitReader;
+
+void cbInitBitWriter(cbBitWriter* writer, void* buffer, int capacity);
+int cbBitWriterBytes(cbBitWriter* writer); // rounded up
+
+void cbWriteBits(cbBitWriter* writer, unsigned int value, int bits); // up to 32 bits
+void cbWriteBool(cbBitWriter* writer, bool value);
+void cbWriteVarint(cbBitWriter* writer, unsigned int value); // 7 bits per group, small is short
+void cbWriteSignedVarint(cbBitWriter* writer, int value); // zigzag, small negative is short
+void cbWriteFloat(cbBitWriter* writer, float value); // exact 32 bits
+// clamped to min, max and stored with bits precision
+void cbWriteQuantized(cbBitWriter* writer, float value, float min, float max, int bits);
+
+void cbInitBitReader(cbBitReader* reader, const void* buffer, int size);
+
+unsigned int cbReadBits(cbBitReader* reader, int bits);
+bool cbReadBool(cbBitReader* reader);
+unsigned int cbReadVarint(cbBitReader* reader);
+int cbReadSignedVarint(cbBitReader* reader);
+float cbReadFloat(cbBitReader* reader);
+float cbReadQuantized(cbBitReader* reader, float min, float max, int bits);
+
+/// SCHEMA
+
+typedef enum {
+    CB_FIELD_INT,
+    CB_FIELD_FLOAT,
+    CB_FIELD_BOOL
+} cbFieldType;
+
+// int - bits 0 is signed varint, else unsigned with bits
+// float - bits 32 is exact, else quantized between min and max
+typedef struct {
+    cbFieldType type;
+    int offset;
+    int bits;
+    float min, max;
+} cbField;
+
+// fields of struct type
+#define cbIntField(type, member, bits) { CB_FIELD_INT, offsetof(type, member), bits, 0.0f, 0.0f }
+#define cbFloatField(type, member, min, max, bits) { CB_FIELD_FLOAT, offsetof(type, member), bits, min, max }
+#define cbBoolField(type, member) { CB_FIELD_BOOL, offsetof(type, member), 1, 0.0f, 0.0f }
+
+// entity struct layout, id field is int and identifies entity between snapshots
+typedef struct {
+    int size;
+    int idOffset;
+    const cbField* fields;
+    int fieldCount;
+} cbSchema;
+
+/// DELTA
+
+// writes dirty mask of fields changed since baseline and changed fields
+// NULL baseline writes all fields, floats are compared quantized
+void cbWriteDelta(cbBitWriter* writer, const cbSchema* schema, const void* baseline, const void* current);
+void cbReadDelta(cbBitReader* reader, const cbSchema* schema, const void* baseline, void* out);
+
+// entities sorted by id, ids are not negative and must grow, else writer overflow is set
+// entity missing from current is removed
+// entities in baseline are delta encoded, new ones are sent whole
+void cbWriteSnapshot(cbBitWriter* writer, const cbSchema* schema, const void* baseline, int baselineCount, const void* current, int count);
+
+// returns entity count written to out, -1 if out is too small or data is broken
+int cbReadSnapshot(cbBitReader* reader, const cbSchema* schema, const void* baseline, int baselineCount, void* out, int capacity);
+
+/// HISTORY
+
+// recent snapshots by sequence, baseline is looked up by sequence peer acked
+typedef struct cbSnapshotHistory cbSnapshotHistory;
+
+cbSnapshotHistory* cbCreateSnapshotHistory(const cbSchema* schema, int capacity);
+void cbDestroySnapshotHistory(cbSnapshotHistory* history);
+
+// copies entities, oldest snapshot is replaced when full
+void cbStoreSnapshot(cbSnapshotHistory* history, unsigned int sequence, const void* entities, int count);
+
+// NULL if sequence is not stored anymore
+const void* cbFindSnapshot(cbSnapshotHistory* history, unsigned int sequence, int* count);
+
+#endif
@@ -0,0 +1,399 @@
+#include "server.h"
+#include "utils.h"
+#include "stretchy_buffer.h"
+#include "tinycthread.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+// client id: generation, slot in worker, worker
+#define CB_SERVER_WORKER_BITS 6
+#define CB_SERVER_SLOT_BITS 14
+#define CB_SERVER_GENERATION_MASK 0x7ff
+#define CB_SERVER_EVENTS 64 // per poller wait
+
+struct cbServerClient {
+    bool used;
+    int generation; // bumped on reuse, stale ids are ignored
+    cbSocket socket;
+    cbConnection* connection;
+    bool dirty; // frames waiting for flush
+    bool stalled; // socket buffer was full, waits for write event
+};
+
+struct cbServerWorker {
+    cbServer* server;
+    int index;
+    thrd_t thread;
+    bool started;
+
+    cbSocket listener;
+    cbPoller* poller;
+    int wake; // eventfd, simulation thread wakes worker
+    atomic_bool wakePending;
+
+    cbQueue* inbound; // worker to simulation
+    cbQueue* outbound; // simulation to worker
+
+    struct cbServerClient* clients; // stretchy buffer
+    int* freeSlots; // stretchy buffer
+    int* dirty; // stretchy buffer, slots to flush
+};
+
+struct cbServer {
+    struct cbServerWorker* workers;
+    int workerCount;
+    atomic_bool running;
+    int nextPoll; // round robin between workers
+};
+
+static int clientId(struct cbServerWorker* worker, int slot) {
+    int generation = worker->clients[slot].generation & CB_SERVER_GENERATION_MASK;
+    return (generation << (CB_SERVER_SLOT_BITS + CB_SERVER_WORKER_BITS)) | (slot << CB_SERVER_WORKER_BITS) | worker->index;
+}
+
+static struct cbServerClient* findClient(struct cbServerWorker* worker, int client, int* slot) {
+    *slot = (client >> CB_SERVER_WORKER_BITS) & ((1 << CB_SERVER_SLOT_BITS) - 1);
+    if (*slot >= sb_count(worker->clients)) return NULL;
+
+    struct cbServerClient* found = &worker->clients[*slot];
+    if (!found->used || clientId(worker, *slot) != client) return NULL;
+    return found;
+}
+
+// waits for room, simulation thread is behind
+static void pushInbound(struct cbServerWorker* worker, cbServerEvent* event) {
+    while (!cbQueuePush(worker->inbound, event)) {
+        if (!atomic_load(&worker->server->running)) {
+            if (event->packet != NULL) {
+                cbPacketRelease(event->packet);
+            }
+            return;
+        }
+        thrd_yield();
+    }
+}
+
+static void acceptClients(struct cbServerWorker* worker) {
+    cbSocket s;
+    while ((s = cbSocketAccept(worker->listener)) >= 0) {
+        int slot;
+        if (sb_count(worker->freeSlots) > 0) {
+            slot = sb_last(worker->freeSlots);
+            stb__sbn(worker->freeSlots)--;
+        } else if (sb_count(worker->clients) < (1 << CB_SERVER_SLOT_BITS)) {
+            slot = sb_count(worker->clients);
+            struct cbServerClient* added = sb_add(worker->clients, 1);
+            memset(added, 0, sizeof(*added));
+        } else {
+            cbCloseSocket(s); // worker is full
+            continue;
+        }
+
+        // frames are coalesced by connection, kernel should not wait more
+        cbSocketSetBlock(s, false);
+        cbSocketSetNoDelay(s, true);
+
+        struct cbServerClient* client = &worker->clients[slot];
+        client->used = true;
+        client->generation++;
+        client->socket = s;
+        client->connection = cbCreateConnection(s);
+        client->dirty = false;
+        client->stalled = false;
+        cbPollerAdd(worker->poller, s, CB_POLL_READ, (void*) (intptr_t) (slot + 1));
+
+        cbServerEvent event = {CB_SERVER_CONNECT, clientId(worker, slot), NULL};
+        pushInbound(worker, &event);
+    }
+}
+
+static void closeClient(struct cbServerWorker* worker, int slot) {
+    struct cbServerClient* client = &worker->clients[slot];
+    cbServerEvent event = {CB_SERVER_DISCONNECT, clientId(worker, slot), NULL};
+
+    cbPollerRemove(worker->poller, client->socket);
+    cbCloseSocket(client->socket);
+    cbDestroyConnection(client->connection);
+    client->used = false;
+    client->connection = NULL;
+    client->dirty = false; // dropped from dirty list on next flush
+    client->stalled = false;
+    sb_push(worker->freeSlots, slot);
+
+    pushInbound(worker, &event);
+}
+
+static void readClient(struct cbServerWorker* worker, int slot) {
+    struct cbServerClient* client = &worker->clients[slot];
+
+    // edge triggered, read until would block
+    int received;
+    do {
+        received = cbConnectionReceive(client->connection);
+
+        cbFrame frame;
+        int result;
+        while ((result = cbConnectionNextFrame(client->connection, &frame)) == 1) {
+            cbPacket* packet = cbNewPacket(frame.length);
+            memcpy(packet->data, frame.data, frame.length);
+            packet->length = frame.length;
+
+            cbServerEvent event = {CB_SERVER_MESSAGE, clientId(worker, slot), packet};
+            pushInbound(worker, &event);
+        }
+        if (result < 0) {
+            received = -1; // broken framing
+        }
+    } while (received > 0);
+
+    if (received < 0) {
+        closeClient(worker, slot);
+    }
+}
+
+static void drainOutbound(struct cbServerWorker* worker) {
+    cbServerEvent command;
+    while (cbQueuePop(worker->outbound, &command)) {
+        int slot;
+        struct cbServerClient* client = findClient(worker, command.client, &slot);
+        if (client != NULL) {
+            if (command.type == CB_SERVER_MESSAGE) {
+                if (!cbConnectionSend(client->connection, command.packet->data, command.packet->length)) {
+                    closeClient(worker, slot); // can not keep up
+                } else if (!client->dirty && !client->stalled) {
+                    client->dirty = true;
+                    sb_push(worker->dirty, slot);
+                }
+            } else if (command.type == CB_SERVER_DISCONNECT) {
+                closeClient(worker, slot);
+            }
+        }
+        if (command.packet != NULL) {
+            cbPacketRelease(command.packet);
+        }
+    }
+}
+
+// one write per client with everything queued this round
+static void flushClients(struct cbServerWorker* worker) {
+    for (int i = 0; i < sb_count(worker->dirty); i++) {
+        int slot = worker->dirty[i];
+        struct cbServerClient* client = &worker->clients[slot];
+        if (!client->used || !client->dirty) continue;
+
+        int pending = cbConnectionFlush(client->connection);
+        if (pending < 0) {
+            closeClient(worker, slot);
+        } else if (pending > 0) {
+            // socket buffer is full, rest goes when poller says it is writable
+            client->dirty = false;
+            client->stalled = true;
+            cbPollerModify(worker->poller, client->socket, CB_POLL_READ | CB_POLL_WRITE, (void*) (intptr_t) (slot + 1));
+        } else {
+            client->dirty = false;
+        }
+    }
+    if (worker->dirty != NULL) {
+        stb__sbn(worker->dirty) = 0;
+    }
+}
+
+static void writeClient(struct cbServerWorker* worker, int slot) {
+    struct cbServerClient* client = &worker->clients[slot];
+    if (!client->stalled) return;
+
+    int pending = cbConnectionFlush(client->connection);
+    if (pending < 0) {
+        closeClient(worker, slot);
+    } else if (pending == 0) {
+        client->stalled = false;
+        cbPollerModify(worker->poller, client->socket, CB_POLL_READ, (void*) (intptr_t) (slot + 1));
+    }
+}
+
+static int workerFunc(void* arg) {
+    struct cbServerWorker* worker = arg;
+    cbSocketEvent events[CB_SERVER_EVENTS];
+
+    while (atomic_load(&worker->server->running)) {
+        int count = cbPollerWait(worker->poller, events, CB_SERVER_EVENTS, 100);
+
+        for (int i = 0; i < count; i++) {
+            if (events[i].socket == worker->wake) {
+                uint64_t value;
+                while (read(worker->wake, &value, sizeof(value)) > 0) {}
+                atomic_store(&worker->wakePending, false); // before drain, later sends wake again
+            } else if (events[i].socket == worker->listener) {
+                acceptClients(worker);
+            } else {
+                int slot = (int) (intptr_t) events[i].data - 1;
+                if (slot >= 0 && slot < sb_count(worker->clients) && worker->clients[slot].used && worker->clients[slot].socket == events[i].socket) {
+                    if (events[i].flags & CB_POLL_WRITE) {
+                        writeClient(worker, slot);
+                    }
+                    if ((events[i].flags & (CB_POLL_READ | CB_POLL_HANGUP | CB_POLL_ERROR)) && worker->clients[slot].used) {
+                        readClient(worker, slot); // sees hangup as closed read
+                    }
+                }
+            }
+        }
+
+        drainOutbound(worker);
+        flushClients(worker);
+    }
+    return 0;
+}
+
+static void destroyWorker(struct cbServerWorker* worker) {
+    for (int i = 0; i < sb_count(worker->clients); i++) {
+        if (worker->clients[i].used) {
+            cbCloseSocket(worker->clients[i].socket);
+            cbDestroyConnection(worker->clients[i].connection);
+        }
+    }
+
+    // packets still queued
+    cbServerEvent event;
+    while (worker->inbound != NULL && cbQueuePop(worker->inbound, &event)) {
+        if (event.packet != NULL) cbPacketRelease(event.packet);
+    }
+    while (worker->outbound != NULL && cbQueuePop(worker->outbound, &event)) {
+        if (event.packet != NULL) cbPacketRelease(event.packet);
+    }
+
+    if (worker->poller != NULL) cbDestroyPoller(worker->poller);
+    if (worker->listener >= 0) cbCloseSocket(worker->listener);
+    if (worker->wake >= 0) close(worker->wake);
+    if (worker->inbound != NULL) cbFreeQueue(worker->inbound);
+    if (worker->outbound != NULL) cbFreeQueue(worker->outbound);
+    sb_free(worker->clients);
+    sb_free(worker->freeSlots);
+    sb_free(worker->dirty);
+}
+
+cbServer* cbStartServer(int port, int workers) {
+    if (workers <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = cpus > 0 ? (int) cpus : 1;
+    }
+    if (workers > CB_SERVER_MAX_WORKERS) {
+        workers = CB_SERVER_MAX_WORKERS;
+    }
+
+    cbServer* server = calloc(1, sizeof(cbServer));
+    server->workers = calloc(workers, sizeof(struct cbServerWorker));
+    server->workerCount = workers;
+    atomic_init(&server->running, true);
+
+    bool failed = false;
+    for (int i = 0; i < workers && !failed; i++) {
+        struct cbServerWorker* worker = &server->workers[i];
+        worker->server = server;
+        worker->index = i;
+        worker->listener = cbOpenSocket();
+        worker->wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        worker->poller = cbCreatePoller();
+        worker->inbound = cbNewQueueFor(cbServerEvent, CB_SERVER_QUEUE_SIZE);
+        worker->outbound = cbNewQueueFor(cbServerEvent, CB_SERVER_QUEUE_SIZE);
+        atomic_init(&worker->wakePending, false);
+
+        if (worker->listener < 0 || !cbSocketListenShared(worker->listener, port)) {
+            printf("server can not listen on port %d\n", port);
+            failed = true;
+            break;
+        }
+        cbSocketSetBlock(worker->listener, false);
+        if (worker->wake < 0 || worker->poller == NULL) {
+            failed = true;
+            break;
+        }
+        cbPollerAdd(worker->poller, worker->listener, CB_POLL_READ, NULL);
+        cbPollerAdd(worker->poller, worker->wake, CB_POLL_READ, NULL);
+    }
+
+    for (int i = 0; i < workers && !failed; i++) {
+        struct cbServerWorker* worker = &server->workers[i];
+        worker->started = thrd_create(&worker->thread, workerFunc, worker) == thrd_success;
+        if (!worker->started) {
+            printf("server worker %d can not be started\n", i);
+            failed = true;
+        }
+    }
+
+    if (failed) {
+        cbStopServer(server);
+        return NULL;
+    }
+    return server;
+}
+
+static void wakeWorker(struct cbServerWorker* worker) {
+    if (!atomic_exchange(&worker->wakePending, true)) {
+        uint64_t one = 1;
+        write(worker->wake, &one, sizeof(one));
+    }
+}
+
+void cbStopServer(cbServer* server) {
+    atomic_store(&server->running, false);
+    for (int i = 0; i < server->workerCount; i++) {
+        struct cbServerWorker* worker = &server->workers[i];
+        if (worker->started) {
+            atomic_store(&worker->wakePending, false);
+            wakeWorker(worker);
+            thrd_join(worker->thread, NULL);
+        }
+    }
+    for (int i = 0; i < server->workerCount; i++) {
+        struct cbServerWorker* worker = &server->workers[i];
+        if (worker->server != NULL) {
+            destroyWorker(worker);
+        }
+    }
+    free(server->workers);
+    free(server);
+}
+
+bool cbServerPoll(cbServer* server, cbServerEvent* event) {
+    for (int i = 0; i < server->workerCount; i++) {
+        struct cbServerWorker* worker = &server->workers[server->nextPoll];
+        server->nextPoll = (server->nextPoll + 1) % server->workerCount;
+        if (cbQueuePop(worker->inbound, event)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool pushOutbound(cbServer* server, cbServerEvent* command) {
+    int index = command->client & ((1 << CB_SERVER_WORKER_BITS) - 1);
+    if (index >= server->workerCount) return false;
+
+    struct cbServerWorker* worker = &server->workers[index];
+    if (!cbQueuePush(worker->outbound, command)) {
+        return false;
+    }
+    wakeWorker(worker);
+    return true;
+}
+
+bool cbServerSend(cbServer* server, int client, cbPacket* packet) {
+    cbPacketRetain(packet);
+    cbServerEvent command = {CB_SERVER_MESSAGE, client, packet};
+    if (!pushOutbound(server, &command)) {
+        cbPacketRelease(packet);
+        return false;
+    }
+    return true;
+}
+
+void cbServerDisconnect(cbServer* server, int client) {
+    cbServerEvent command = {CB_SERVER_DISCONNECT, client, NULL};
+    pushOutbound(server, &command);
+}
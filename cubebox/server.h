@@ -0,0 +1,48 @@
+// multi threaded server
+// each worker thread has own listening socket on shared port, own poller and own clients
+// simulation thread talks to workers through lock-free queues
+#ifndef CB_SERVER_H
+#define CB_SERVER_H
+
+#include "net.h"
+
+#include <stdbool.h>
+
+// events and sends queued between each worker and simulation thread
+#ifndef CB_SERVER_QUEUE_SIZE
+    #define CB_SERVER_QUEUE_SIZE 8192
+#endif
+
+// most workers, client id keeps worker in low bits
+#define CB_SERVER_MAX_WORKERS 64
+
+typedef struct cbServer cbServer;
+
+typedef enum {
+    CB_SERVER_CONNECT,
+    CB_SERVER_MESSAGE,
+    CB_SERVER_DISCONNECT
+} cbServerEventType;
+
+typedef struct {
+    cbServerEventType type;
+    int client;
+    cbPacket* packet; // message frame, release after use
+} cbServerEvent;
+
+// workers 0 - one per cpu, clients exchange length prefixed frames, see CONNECTION in net.h
+cbServer* cbStartServer(int port, int workers);
+void cbStopServer(cbServer* server);
+
+// functions below are for simulation thread only
+
+// pops next event of any worker, false if none
+bool cbServerPoll(cbServer* server, cbServerEvent* event);
+
+// packet is retained, same packet may go to many clients
+// false if worker queue is full
+bool cbServerSend(cbServer* server, int client, cbPacket* packet);
+
+void cbServerDisconnect(cbServer* server, int client);
+
+#endif
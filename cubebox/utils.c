@@ -4,6 +4,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <stdatomic.h>
+#include <time.h>
 
 cbShader cbCreateShader(const char *vsrc, const char *fsrc) {
     cbShader program;
@@ -173,3 +175,64 @@ void cbFreeList(cbList* list) {
     }
     free(list);
 }
+
+struct cbQueue {
+    int elementSize;
+    unsigned int mask;
+    char *data;
+    // on separate cache lines, written by different threads
+    _Alignas(64) atomic_uint head; // next to pop
+    _Alignas(64) atomic_uint tail; // next to push
+};
+
+cbQueue* cbNewQueue(int elementSize, int capacity) {
+    unsigned int size = 1;
+    while (size < (unsigned int) capacity) {
+        size <<= 1;
+    }
+
+    cbQueue* queue = aligned_alloc(64, sizeof(cbQueue));
+    queue->elementSize = elementSize;
+    queue->mask = size - 1;
+    queue->data = malloc((size_t) size * elementSize);
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+    return queue;
+}
+
+bool cbQueuePush(cbQueue* queue, const void* data) {
+    unsigned int tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    unsigned int head = atomic_load_explicit(&queue->head, memory_order_acquire);
+    if (tail - head > queue->mask) {
+        return false; // full
+    }
+
+    memcpy(queue->data + (size_t) (tail & queue->mask) * queue->elementSize, data, queue->elementSize);
+    atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+bool cbQueuePop(cbQueue* queue, void* data) {
+    unsigned int head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+    if (head == tail) {
+        return false; // empty
+    }
+
+    memcpy(data, queue->data + (size_t) (head & queue->mask) * queue->elementSize, queue->elementSize);
+    atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+    return true;
+}
+
+void cbFreeQueue(cbQueue* queue) {
+    free(queue->data);
+    free(queue);
+}
+
+/// TIME
+
+long long cbNanoTime() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (long long) t.tv_sec * 1000000000LL + t.tv_nsec;
+}
@@ -3,6 +3,8 @@
 
 #include "glad.h"
 
+#include <stdbool.h>
+
 /// SHADERS
 
 typedef GLuint cbShader;
@@ -48,4 +50,29 @@ void cbListRemove(cbList* list, int at);
 // frees list and all its elements
 void cbFreeList(cbList* list);
 
+/// QUEUE
+
+// single producer single consumer lock-free queue
+// one thread pushes, other thread pops
+typedef struct cbQueue cbQueue;
+
+// capacity is rounded up to power of two
+cbQueue* cbNewQueue(int elementSize, int capacity);
+
+// short code for typed queue
+#define cbNewQueueFor(type, capacity) cbNewQueue(sizeof(type), capacity)
+
+// copies element to queue, returns false if queue is full
+bool cbQueuePush(cbQueue* queue, const void* data);
+
+// copies element from queue, returns false if queue is empty
+bool cbQueuePop(cbQueue* queue, void* data);
+
+void cbFreeQueue(cbQueue* queue);
+
+/// TIME
+
+// monotonic nanoseconds from any fixed point
+long long cbNanoTime();
+
 #endif